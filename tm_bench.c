@@ -0,0 +1,579 @@
+#define _DEFAULT_SOURCE
+#include "tmtracker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define BENCH_ZONE "Europe/Berlin" // Has DST, so transitions get covered
+#define BENCH_DIR "/tmp/tm_bench.XXXXXX"
+#define BENCH_IMPORT "bench.csv"
+
+enum {
+    first_year = 2006,
+    span_years = 20,
+    default_reps = 5,
+    default_warmup = 1,
+    max_sizes = 16,
+    delete_count = 100, // Deletions timed against a fully indexed store
+    compact_ratio = 100 // 1 in this many is tombstoned before compacting
+};
+
+// Sessions are generated once per size and copied for every repetition
+typedef struct Dataset {
+    Interval *items;    // Sorted by start
+    Interval *shuffled; // Same sessions in random order
+    int count;
+    int first_day;
+    int last_day;
+    IntervalStore indexed; // Shared by the read-only queries
+    IntervalStore store;   // Scratch store each repetition starts from
+    unsigned char *archive; // All sessions as one archived segment
+    size_t archive_size;
+    struct tm *civil;      // Local time of every start, for the mktime operations
+    size_t bytes;          // Encoded size, for operations that have one
+} Dataset;
+
+typedef struct Operation {
+    const char *name;
+    void (*setup)(Dataset *data);
+    long (*run)(Dataset *data); // Returns how many items it processed
+    int import_threads; // 0 lets import_all() choose
+} Operation;
+
+static uint64_t next_random(uint64_t *state)
+{
+    // splitmix64, so every run generates the same dataset
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static time_t local_time(int year, int month, int day, int hour, int min)
+{
+    struct tm t = {
+        .tm_year = year - 1900, .tm_mon = month - 1, .tm_mday = day,
+        .tm_hour = hour, .tm_min = min, .tm_isdst = -1
+    };
+    return local_mktime(&t);
+}
+
+// Last Sunday of the month, when EU clocks change
+static int last_sunday(int year, int month)
+{
+    int last = (month == months_in_year ? days_from_civil(year + 1, 1, 1)
+            : days_from_civil(year, month + 1, 1)) - 1;
+    int weekday = ((last % days_in_week) + days_in_week + 4) % days_in_week; // 1970-01-01 was a Thursday
+    return last - days_from_civil(year, month, 1) + 1 - weekday;
+}
+
+static void copy_items(IntervalStore *store, const Interval *items, int count)
+{
+    for(int i = 0; i < count; i++)
+        *store_append(store) = items[i];
+}
+
+// Spreads count sessions over span_years, plus a few per year that cross
+// New Year's Eve and both DST changes, across max_categories categories
+static void generate(Dataset *data, int count)
+{
+    uint64_t seed = 1;
+    time_t from = local_time(first_year, 1, 1, 0, 0);
+    time_t to = local_time(first_year + span_years, 1, 1, 0, 0);
+    IntervalStore store = {0};
+
+    for(int year = first_year; year < first_year + span_years; year++) {
+        time_t edges[] = {
+            local_time(year, 12, 31, 23, 20),
+            local_time(year, 3, last_sunday(year, 3), 1, 40),
+            local_time(year, 10, last_sunday(year, 10), 2, 20)
+        };
+        for(size_t e = 0; e < sizeof(edges) / sizeof(edges[0]) && store.count < count; e++) {
+            Interval *interval = store_append(&store);
+            *interval = (Interval){
+                .category_idx = store.count % max_categories,
+                .start = edges[e],
+                .end = edges[e] + seconds_in_hour + seconds_in_hour / 3
+            };
+        }
+    }
+
+    double stride = (double)(to - from) / count;
+    double at = from;
+    while(store.count < count) {
+        at += stride * (0.5 + (next_random(&seed) % 1000) / 1000.0);
+        int duration = min_time
+            + next_random(&seed) % (max_time * seconds_in_minute - min_time + 1);
+        Interval *interval = store_append(&store);
+        *interval = (Interval){
+            .category_idx = next_random(&seed) % max_categories,
+            .start = (time_t)at,
+            .end = (time_t)at + duration
+        };
+    }
+    store_sort(&store);
+
+    data->count = store.count;
+    data->items = malloc((size_t)count * sizeof(Interval));
+    data->shuffled = malloc((size_t)count * sizeof(Interval));
+    if(!data->items || !data->shuffled) {
+        perror("tm_bench: Cannot allocate dataset");
+        exit(1);
+    }
+    memcpy(data->items, store.items, (size_t)count * sizeof(Interval));
+    memcpy(data->shuffled, store.items, (size_t)count * sizeof(Interval));
+    for(int i = count - 1; i > 0; i--) {
+        int j = next_random(&seed) % (i + 1);
+        Interval swap = data->shuffled[i];
+        data->shuffled[i] = data->shuffled[j];
+        data->shuffled[j] = swap;
+    }
+    store_free(&store);
+
+    data->civil = malloc((size_t)count * sizeof(struct tm));
+    if(!data->civil) {
+        perror("tm_bench: Cannot allocate dataset");
+        exit(1);
+    }
+    for(int i = 0; i < count; i++) {
+        local_civil(data->items[i].start, &data->civil[i]);
+        data->civil[i].tm_isdst = -1;
+    }
+
+    struct tm t;
+    local_civil(from, &t);
+    data->first_day = tm_day_number(&t);
+    local_civil(to - 1, &t);
+    data->last_day = tm_day_number(&t);
+
+    data->indexed = (IntervalStore){0};
+    copy_items(&data->indexed, data->items, count);
+    store_build_indexes(&data->indexed);
+    push_intervals(&data->indexed);
+    data->archive = archive_encode(data->items, count, &data->archive_size);
+}
+
+static void setup_sorted(Dataset *data)
+{
+    copy_items(&data->store, data->items, data->count);
+}
+
+static void setup_shuffled(Dataset *data)
+{
+    copy_items(&data->store, data->shuffled, data->count);
+}
+
+static void setup_indexed(Dataset *data)
+{
+    setup_sorted(data);
+    store_build_indexes(&data->store);
+}
+
+static void setup_tombstoned(Dataset *data)
+{
+    setup_sorted(data);
+    for(int i = 0; i < data->count; i += compact_ratio)
+        delete_interval(&data->store, i);
+}
+
+// Without a manifest every month is written
+static void setup_unsaved(Dataset *data)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s/manifest", getenv("HOME"), SEGMENTS_DIR);
+    unlink(path);
+    setup_sorted(data);
+}
+
+// The common save: the latest session changed, everything else is as saved
+static void setup_changed(Dataset *data)
+{
+    static int change;
+    setup_sorted(data);
+    data->store.items[data->count - 1].end += ++change % seconds_in_minute + 1;
+}
+
+static long run_save(Dataset *data)
+{
+    push_intervals(&data->store);
+    return data->count;
+}
+
+// Same steps main() takes before the first frame
+static long run_load(Dataset *data)
+{
+    pull_intervals(&data->store);
+    store_sort(&data->store);
+    replay_journal(&data->store);
+    validate_intervals(&data->store);
+    return data->store.count;
+}
+
+// What the first frame needs: the last day of the span
+static long run_load_recent(Dataset *data)
+{
+    pull_recent_intervals(&data->store, day_start(data->last_day));
+    return data->store.count;
+}
+
+// What reading a raw segment costs once its pages are in memory
+static long run_raw_copy(Dataset *data)
+{
+    memcpy(data->store.items, data->items, (size_t)data->count * sizeof(Interval));
+    data->bytes = (size_t)data->count * sizeof(Interval);
+    return data->count;
+}
+
+static long run_archive_encode(Dataset *data)
+{
+    free(archive_encode(data->items, data->count, &data->bytes));
+    return data->count;
+}
+
+static long run_archive_decode(Dataset *data)
+{
+    archive_decode(data->archive, data->archive_size, data->store.items, data->count);
+    data->bytes = data->archive_size;
+    return data->count;
+}
+
+static long run_validate(Dataset *data)
+{
+    validate_intervals(&data->store);
+    return data->count;
+}
+
+static long run_sort(Dataset *data)
+{
+    store_sort(&data->store);
+    return data->count;
+}
+
+static long run_rollup(Dataset *data)
+{
+    for(int i = 0; i < data->store.count; i++)
+        rollup_add(&data->store.rollup, &data->store.items[i], 1);
+    return data->count;
+}
+
+static long run_orders(Dataset *data)
+{
+    store_build_orders(&data->store);
+    return data->count;
+}
+
+// The stats screen's query for every day of the span, per-category
+// breakdown included
+static long run_stats(Dataset *data, get_period get_range)
+{
+    volatile int sink = 0;
+    for(int day = data->first_day; day <= data->last_day; day++) {
+        struct tm t;
+        int first_day, last_day;
+        local_civil(day_start(day), &t);
+        get_range(&t, &first_day, &last_day);
+        sink += get_period_total(&data->indexed.rollup, max_categories, first_day, last_day);
+        for(int c = 0; c < max_categories; c++)
+            sink += rollup_category_total(&data->indexed.rollup, c, first_day, last_day);
+    }
+    (void)sink;
+    return data->last_day - data->first_day + 1;
+}
+
+static long run_stats_day(Dataset *data)
+{
+    return run_stats(data, get_day_period);
+}
+
+static long run_stats_week(Dataset *data)
+{
+    return run_stats(data, get_week_period);
+}
+
+static long run_stats_month(Dataset *data)
+{
+    return run_stats(data, get_month_period);
+}
+
+static long run_stats_year(Dataset *data)
+{
+    return run_stats(data, get_year_period);
+}
+
+static long run_delete(Dataset *data)
+{
+    int step = data->count / delete_count > 0 ? data->count / delete_count : 1;
+    long deleted = 0;
+    for(int i = 0; i < data->count; i += step, deleted++)
+        delete_interval(&data->store, i);
+    return deleted;
+}
+
+static long run_compact(Dataset *data)
+{
+    store_compact(&data->store);
+    return data->count;
+}
+
+static void name_categories(Category *categories)
+{
+    for(int c = 0; c < max_categories; c++) {
+        snprintf(categories[c].name, name_max_length, "Category %d", c + 1);
+        categories[c].id = c;
+    }
+}
+
+static long run_export(Dataset *data)
+{
+    Category categories[max_categories] = {0};
+    name_categories(categories);
+    int fd = open("/dev/null", O_WRONLY);
+    ExportWriter *w = writer_open(fd, export_csv);
+    long written = export_sessions(w, &data->indexed, categories, max_categories);
+    writer_close(w);
+    close(fd);
+    return written;
+}
+
+// Drops a CSV export of every session where import_all() picks it up;
+// the previous repetition's copy was renamed once imported
+static void setup_import(Dataset *data)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", getenv("HOME"), IMPORT_DIR);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/%s", getenv("HOME"), IMPORT_DIR, BENCH_IMPORT);
+    Category categories[max_categories] = {0};
+    name_categories(categories);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        perror("tm_bench: Cannot write import file");
+        exit(1);
+    }
+    ExportWriter *w = writer_open(fd, export_csv);
+    export_sessions(w, &data->indexed, categories, max_categories);
+    if(!writer_close(w) || close(fd) != 0) {
+        perror("tm_bench: Cannot write import file");
+        exit(1);
+    }
+    struct stat st;
+    data->bytes = stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+// Parsing, merging and saving the sessions into an empty history
+static long run_import(Dataset *data)
+{
+    Category categories[max_categories] = {0};
+    int category_count = 0, report_count;
+    ImportReport *reports = import_all(&data->store, categories, &category_count, &report_count);
+    long imported = 0;
+    for(int i = 0; i < report_count; i++)
+        imported += reports[i].imported;
+    free(reports);
+    return imported;
+}
+
+static long run_local_civil(Dataset *data)
+{
+    struct tm t;
+    for(int i = 0; i < data->count; i++)
+        local_civil(data->items[i].start, &t);
+    return data->count;
+}
+
+static long run_localtime(Dataset *data)
+{
+    struct tm t;
+    for(int i = 0; i < data->count; i++)
+        localtime_r(&data->items[i].start, &t);
+    return data->count;
+}
+
+static long run_local_mktime(Dataset *data)
+{
+    for(int i = 0; i < data->count; i++) {
+        struct tm t = data->civil[i];
+        local_mktime(&t);
+    }
+    return data->count;
+}
+
+static long run_mktime(Dataset *data)
+{
+    for(int i = 0; i < data->count; i++) {
+        struct tm t = data->civil[i];
+        mktime(&t);
+    }
+    return data->count;
+}
+
+static const Operation operations[] = {
+    { "save_full", setup_unsaved, run_save },
+    { "save", setup_changed, run_save },
+    { "load", NULL, run_load },
+    { "load_recent", NULL, run_load_recent },
+    { "raw_copy", setup_sorted, run_raw_copy },
+    { "archive_encode", NULL, run_archive_encode },
+    { "archive_decode", setup_sorted, run_archive_decode },
+    { "validate", setup_sorted, run_validate },
+    { "sort", setup_shuffled, run_sort },
+    { "rollup", setup_sorted, run_rollup },
+    { "orders", setup_sorted, run_orders },
+    { "stats_day", NULL, run_stats_day },
+    { "stats_week", NULL, run_stats_week },
+    { "stats_month", NULL, run_stats_month },
+    { "stats_year", NULL, run_stats_year },
+    { "delete", setup_indexed, run_delete },
+    { "compact", setup_tombstoned, run_compact },
+    { "export_csv", NULL, run_export },
+    { "import", setup_import, run_import },
+    { "import_1", setup_import, run_import, 1 },
+    { "import_2", setup_import, run_import, 2 },
+    { "import_4", setup_import, run_import, 4 },
+    { "import_8", setup_import, run_import, 8 },
+    { "local_civil", NULL, run_local_civil },
+    { "localtime_r", NULL, run_localtime },
+    { "local_mktime", NULL, run_local_mktime },
+    { "mktime", NULL, run_mktime },
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void report(bool json, int sessions, const char *name, int reps,
+        long items, size_t bytes, double *times)
+{
+    qsort(times, reps, sizeof(double), compare_double);
+    double sum = 0;
+    for(int i = 0; i < reps; i++)
+        sum += times[i];
+    double median = reps % 2 ? times[reps / 2]
+        : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+    if(json)
+        printf("{\"sessions\":%d,\"operation\":\"%s\",\"reps\":%d,\"items\":%ld,\"bytes\":%zu,"
+                "\"min_ms\":%.3f,\"median_ms\":%.3f,\"mean_ms\":%.3f,\"max_ms\":%.3f}\n",
+                sessions, name, reps, items, bytes, times[0], median, sum / reps, times[reps - 1]);
+    else
+        printf("%d,%s,%d,%ld,%zu,%.3f,%.3f,%.3f,%.3f\n",
+                sessions, name, reps, items, bytes, times[0], median, sum / reps, times[reps - 1]);
+    fflush(stdout);
+}
+
+static void bench_size(int sessions, int warmup, int reps, bool json)
+{
+    Dataset data = {0};
+    generate(&data, sessions);
+
+    double times[reps];
+    for(size_t o = 0; o < sizeof(operations) / sizeof(operations[0]); o++) {
+        const Operation *op = &operations[o];
+        long items = 0;
+        set_import_threads(op->import_threads);
+        for(int r = -warmup; r < reps; r++) {
+            data.store = (IntervalStore){0};
+            data.bytes = 0;
+            if(op->setup)
+                op->setup(&data);
+            double start = now_ms();
+            items = op->run(&data);
+            double elapsed = now_ms() - start;
+            if(r >= 0)
+                times[r] = elapsed;
+            store_free(&data.store);
+        }
+        report(json, sessions, op->name, reps, items, data.bytes, times);
+    }
+
+    store_free(&data.indexed);
+    free(data.items);
+    free(data.archive);
+    free(data.civil);
+    free(data.shuffled);
+}
+
+// Removes the scratch directory with everything the operations wrote
+static void remove_tree(const char *path)
+{
+    char child[PATH_MAX];
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    while(dir && (entry = readdir(dir))) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if(entry->d_type == DT_DIR)
+            remove_tree(child);
+        else
+            unlink(child);
+    }
+    if(dir)
+        closedir(dir);
+    rmdir(path);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: tm_bench [--reps N] [--warmup N] [--json] [sessions...]\n"
+            "Times the core operations on generated histories, 10000 100000\n"
+            "and 1000000 sessions by default. Prints CSV, or NDJSON with --json.\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int sizes[max_sizes];
+    int size_count = 0;
+    int reps = default_reps, warmup = default_warmup;
+    bool json = false;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if(argv[i][0] != '-' && size_count < max_sizes && atoi(argv[i]) > 0)
+            sizes[size_count++] = atoi(argv[i]);
+        else
+            usage();
+    }
+    if(reps < 1 || warmup < 0)
+        usage();
+    if(size_count == 0) {
+        sizes[size_count++] = 10000;
+        sizes[size_count++] = 100000;
+        sizes[size_count++] = 1000000;
+    }
+
+    // Data files go to a scratch HOME, never the user's history
+    char dir[] = BENCH_DIR;
+    if(!mkdtemp(dir)) {
+        perror("tm_bench: Cannot create scratch directory");
+        return 1;
+    }
+    setenv("HOME", dir, 1);
+    setenv("TZ", BENCH_ZONE, 0);
+
+    if(!json)
+        printf("sessions,operation,reps,items,bytes,min_ms,median_ms,mean_ms,max_ms\n");
+    for(int i = 0; i < size_count; i++)
+        bench_size(sizes[i], warmup, reps, json);
+
+    remove_tree(dir);
+    return 0;
+}
@@ -1,43 +1,30 @@
 #define _DEFAULT_SOURCE
+#include "tmtracker.h"
 #include <curses.h>
 #include <stdlib.h>
-#include <time.h>
-#include <stdbool.h>
 #include <string.h>
-
-#ifndef PATH_MAX
-    #define PATH_MAX 4096
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#ifdef __linux__
+    #include <sys/timerfd.h>
 #endif
-#define CATEGORIES_FILE ".categories.dat"
-#define INTERVALS_FILE ".intervals.dat"
-#define FOREST_FILE ".forest.csv"
-#define FOREST_IMPORTED ".forest_imported"
+
 #define ESC_HINT "<- Esc"
 #define DAY_TITLE "DAY"
 
 enum {
     line_length = 50,
-    name_max_length = 30,
-    max_categories = 5,
-    max_intervals = 5000,
-    max_time = 120, // in minutes
     key_escape = 27,
     key_enter = 10,
     key_space = 32,
-    default_timeout = 1000,
     colors_max = 256,
     bar_gap = 4,
     bar_height = 3,
-    hours_in_day = 24,
-    minutes_in_hour = 60,
-    seconds_in_minute = 60,
-    seconds_in_hour = 3600,
-    days_in_year = 366,
-    days_in_week = 7,
-    months_in_year = 12,
-    min_time = 300, // in seconds
-    forest_values = 13,
     visible_rows = 20, // How many history items fit screen
+    row_cache_size = visible_rows * 4, // Formatted rows kept across scrolling
+    history_row_length = 96,
     time_buff_len = 5,
     max_time_buff_len = 7,
 
@@ -70,19 +57,11 @@ enum {
     CMD_CATEGORY = 'c',
     CMD_HISTORY = 'h',
     CMD_STATS = 't',
-    CMD_CREATE = 'a'
+    CMD_CREATE = 'a',
+    CMD_UNDO = 'u',
+    CMD_EXPORT = 'e'
 };
 
-typedef struct Category {
-    char name[name_max_length];
-} Category;
-
-typedef struct Interval {
-    int category_idx; // Index into the categories array
-    time_t start;
-    time_t end;
-} Interval;
-
 static void action_bar(const char **bar_items, int bar_count)
 {
     int rows, cols;
@@ -108,46 +87,90 @@ static void action_bar(const char **bar_items, int bar_count)
     refresh();
 }
 
-static void print_time(
+// What the active window currently shows, so a tick only rewrites the
+// cells that differ
+typedef struct ActiveView {
+    bool framed;
+    int time_len;
+    char time[time_buff_len + 1];
+    const char *msg;
+} ActiveView;
+
+// Cells the active screen queued for curses against what repainting the
+// whole window every tick would queue. Not terminal bytes: curses writes
+// to the terminal's descriptor directly, past any stream it is handed.
+static struct {
+    long ticks;
+    size_t queued;
+    size_t repainted;
+} render_stats;
+
+static void print_active_frame(
         WINDOW *win,
+        ActiveView *view,
         Interval *interval,
         Category *categories,
-        int height, int width,
+        int width,
         int category_count)
 {
+    box(win, 0, 0);
 
-    time_t current = time(NULL);
-    time_t passed = current - interval->start;
-
-    int minutes = passed / seconds_in_minute;
-    int seconds = passed % seconds_in_minute;
-
-    char *category;
-    if(interval->category_idx >= 0 && interval->category_idx < category_count)
-        category = categories[interval->category_idx].name;
-    else
-        category = "[Unknown]";
+    const char *category = category_label(categories, category_count, interval->category_idx);
     wattron(win, A_BOLD);
     mvwprintw(win, 1, (width - strlen(category)) / 2, "%s", category);
     wattroff(win, A_BOLD);
 
-    char time_buff[time_buff_len + 1];
-    int len = snprintf(time_buff, time_buff_len + 1, "%02d:%02d", minutes, seconds);
-    mvwaddstr(win, height - time_buff_offset, (width - len) / 2, time_buff);
-
-    char msg[name_max_length] = {0};
-    if(time(NULL) - interval->start < min_time)
-        strncpy(msg, "[Esc] Give Up!", name_max_length - 1);
-    else
-        strncpy(msg, "[Esc] Stop", name_max_length - 1);
+    view->framed = true;
+    view->time_len = 0;
+    view->msg = NULL;
+}
 
-    mvwhline(win, height - 2, 1, ' ', width - 2);
+// Returns how many cells were queued
+static size_t print_time(
+        WINDOW *win,
+        ActiveView *view,
+        Interval *interval,
+        int height, int width)
+{
+    size_t queued = 0;
+    time_t passed = interval->end - interval->start;
 
-    wattron(win, COLOR_PAIR(3));
-    mvwprintw(win, height - 2, (width - strlen(msg)) / 2, "%s", msg);
-    wattroff(win, COLOR_PAIR(3));
+    int minutes = passed / seconds_in_minute;
+    int seconds = passed % seconds_in_minute;
 
-    wrefresh(win);
+    char time_buff[time_buff_len + 1];
+    int len = snprintf(time_buff, time_buff_len + 1, "%02d:%02d", minutes, seconds);
+    if(len > time_buff_len)
+        len = time_buff_len;
+    int time_y = height - time_buff_offset;
+    if(len != view->time_len) {
+        // Centering moved, rewrite the whole span
+        mvwhline(win, time_y, 1, ' ', width - 2);
+        mvwaddstr(win, time_y, (width - len) / 2, time_buff);
+        queued += width - 2;
+    } else {
+        int x = (width - len) / 2;
+        for(int i = 0; i < len; i++) {
+            if(time_buff[i] == view->time[i])
+                continue;
+            mvwaddch(win, time_y, x + i, time_buff[i]);
+            queued++;
+        }
+    }
+    memcpy(view->time, time_buff, len + 1);
+    view->time_len = len;
+
+    const char *msg = passed < min_time ? "[Esc] Give Up!" : "[Esc] Stop";
+    if(msg != view->msg) {
+        mvwhline(win, height - 2, 1, ' ', width - 2);
+
+        wattron(win, COLOR_PAIR(3));
+        mvwprintw(win, height - 2, (width - strlen(msg)) / 2, "%s", msg);
+        wattroff(win, COLOR_PAIR(3));
+        view->msg = msg;
+        queued += width - 2;
+    }
+    return queued;
 }
 
 static bool get_text_input(char *buffer, int max_len) {
@@ -240,7 +263,7 @@ static void show_error(char *msg)
     refresh();
 }
 
-static void add_category(Category *categories, int *category_count)
+static void add_category(IntervalStore *store, Category *categories, int *category_count)
 {
     clear();
     refresh();
@@ -249,6 +272,11 @@ static void add_category(Category *categories, int *category_count)
         show_error("Cannot add more than 5 categories");
         return;
     }
+    int id = next_category_id(store, categories, *category_count);
+    if(id < 0) {
+        show_error("No category ids left");
+        return;
+    }
 
     char temp_name[name_max_length] = {0};
 
@@ -259,21 +287,9 @@ static void add_category(Category *categories, int *category_count)
     } while(strlen(temp_name) <= 0);
     strncpy(categories[*category_count].name, temp_name, name_max_length - 1);
     categories[*category_count].name[name_max_length - 1] = '\0';
+    categories[*category_count].id = id;
     (*category_count)++;
-}
-
-static void delete_category(Category *categories, int *category_count, int idx)
-{
-    for(int i = idx; i < (*category_count) - 1; i++)
-        categories[i] = categories[i+1];
-    (*category_count)--;
-}
-
-static void delete_interval(Interval *intervals, int *count, int idx)
-{
-    for(int i = idx; i < (*count) - 1; i++)
-        intervals[i] = intervals[i+1];
-    (*count)--;
+    rollup_map_categories(&store->rollup, categories, *category_count);
 }
 
 typedef void (*print_query)(WINDOW*, const char*, int);
@@ -371,7 +387,10 @@ static bool confirm_action(
     return result;
 }
 
-static void categories_dashboard(Category *categories, int *category_count, int *chosen)
+static void categories_dashboard(IntervalStore *store,
+        Category *categories,
+        int *category_count,
+        int *chosen)
 {
     erase(); 
     refresh();
@@ -413,12 +432,15 @@ static void categories_dashboard(Category *categories, int *category_count, int
         key = getch();
         switch(key) {
         case CMD_CREATE:
-            add_category(categories, category_count);
+            add_category(store, categories, category_count);
+            push(categories, sizeof(Category), *category_count, CATEGORIES_FILE);
             break;
         case CMD_DELETE:
             if(*category_count > 0
-                    && confirm_action(print_delete_query, categories[highlight].name))     
-                delete_category(categories, category_count, highlight);
+                    && confirm_action(print_delete_query, categories[highlight].name)) {
+                delete_category(&store->rollup, categories, category_count, highlight);
+                push(categories, sizeof(Category), *category_count, CATEGORIES_FILE);
+            }
             if(highlight >= (*category_count))
                 highlight = *category_count - 1;
             erase(); 
@@ -446,115 +468,109 @@ static void categories_dashboard(Category *categories, int *category_count, int
     }
 }
 
-static void print_history_item(Interval *interval,
-        int idx,
+// Formats everything after the "- [n] " prefix, which depends on the view
+static void format_history_item(const Interval *interval,
         Category *categories,
         int category_count,
-        int y, int x,
-        bool highlighted)
+        char *row, size_t size)
 {
     time_t time_focused = interval->end - interval->start;
 
-    struct tm *start = localtime(&interval->start);
-    int start_h = start->tm_hour;
-    int start_m = start->tm_min;
-    int start_month = start->tm_mon + 1; 
-    int start_day = start->tm_mday;
-    int start_year = start->tm_year + 1900;
+    struct tm start, end;
+    local_civil(interval->start, &start);
+    int start_h = start.tm_hour;
+    int start_m = start.tm_min;
+    int start_month = start.tm_mon + 1; 
+    int start_day = start.tm_mday;
+    int start_year = start.tm_year + 1900;
 
-    struct tm *end = localtime(&interval->end);
-    int end_h = end->tm_hour;
-    int end_m = end->tm_min;
+    local_civil(interval->end, &end);
+    int end_h = end.tm_hour;
+    int end_m = end.tm_min;
 
     int minutes_focused = time_focused / 60;
     int seconds_focused = time_focused % 60;
 
-    char category_name[name_max_length] = {0};
-
-    if(!highlighted) attron(COLOR_PAIR(3));
-    if(interval->category_idx >= category_count || interval->category_idx < 0)
-        strncpy(category_name, "[Unknown]", name_max_length);
-    else
-        strncpy(category_name, categories[interval->category_idx].name, name_max_length);
-    mvhline(y, x, ' ', 75);
-    mvprintw(y, x, "%c [%d] %s: [%02d/%02d/%d]%02d:%02d-%02d:%02d(%02dm%02ds)",
-            highlighted ? '>' : '-',
-            idx + 1,
+    const char *category_name = category_label(categories, category_count,
+            interval->category_idx);
+    snprintf(row, size, "%s: [%02d/%02d/%d]%02d:%02d-%02d:%02d(%02dm%02ds)",
             category_name,
             start_day, start_month, start_year,
             start_h, start_m,
             end_h, end_m, minutes_focused,
             seconds_focused);
-    if(!highlighted) attroff(COLOR_PAIR(3));
 }
 
-static int compare_duration(const void *a, const void *b)
-{
-    const Interval *interval_a = (const Interval *)a;
-    const Interval *interval_b = (const Interval *)b;
+// Formatted rows keyed by store position, which stays stable for the
+// whole history visit since deletions only tombstone
+typedef struct HistoryRowCache {
+    int positions[row_cache_size]; // -1 marks an empty slot
+    char rows[row_cache_size][history_row_length];
+} HistoryRowCache;
 
-    int duration_a = interval_a->end - interval_a->start;
-    int duration_b = interval_b->end - interval_b->start;
-    return duration_a - duration_b;
+static void row_cache_init(HistoryRowCache *cache)
+{
+    for(int i = 0; i < row_cache_size; i++)
+        cache->positions[i] = -1;
 }
 
-static int compare_date(const void *a, const void *b)
+static const char *cached_history_row(HistoryRowCache *cache,
+        IntervalStore *store,
+        int position,
+        Category *categories,
+        int category_count)
 {
-    const Interval *interval_a = (const Interval *)a;
-    const Interval *interval_b = (const Interval *)b;
+    int slot = position % row_cache_size;
+    if(cache->positions[slot] != position) {
+        format_history_item(&store->items[position], categories, category_count,
+                cache->rows[slot], history_row_length);
+        cache->positions[slot] = position;
+    }
+    return cache->rows[slot];
+}
 
-    if(interval_a->start < interval_b->start)
-        return -1;
-    else if(interval_a->start > interval_b->start)
-        return 1;
-    else
-        return 0;
+static void print_history_item(const char *row,
+        int idx,
+        int y, int x,
+        bool highlighted)
+{
+    if(!highlighted) attron(COLOR_PAIR(3));
+    mvhline(y, x, ' ', history_row_length);
+    mvprintw(y, x, "%c [%d] %s", highlighted ? '>' : '-', idx + 1, row);
+    if(!highlighted) attroff(COLOR_PAIR(3));
 }
 
-static void print_date_history_list(
-        Interval *intervals,
+// Draws a single rank if it is on screen
+static void print_history_row(
+        IntervalStore *store,
+        HistoryRowCache *cache,
+        SortOrder sort,
         Category *categories,
         int category_count,
-        int interval_count,
+        int rank,
         int scroll_offset,
         int start_y, int start_x,
         bool reversed,
         int highlight
         )
 {
-    mvhline(start_y, start_x, ACS_HLINE, line_length);
-    if(!reversed)
-        for(int i = 0; i < visible_rows; i++) {
-            int actual_idx = scroll_offset + i;
-            if(actual_idx >= interval_count)
-                break;
-            print_history_item(&intervals[actual_idx],
-                    actual_idx,
-                    categories,
-                    category_count,
-                    start_y + i + 1, start_x,
-                    actual_idx == highlight);
-        }
-    else
-        for(int i = 0; i < visible_rows; i++) {
-            int actual_idx = scroll_offset - i;
-            if(actual_idx < 0)
-                break;
-            print_history_item(&intervals[actual_idx],
-                    actual_idx,
-                    categories,
-                    category_count,
-                    start_y + i + 1, start_x,
-                    actual_idx == highlight);
-        }
-    mvhline(start_y + visible_rows + 1, start_x, ACS_HLINE, line_length);
+    // Reversed views walk the same order backwards
+    int row = reversed ? scroll_offset - rank : rank - scroll_offset;
+    if(row < 0 || row >= visible_rows || rank < 0 || rank >= store_live_count(store))
+        return;
+    int position = store_ordered(store, sort, rank);
+    print_history_item(cached_history_row(cache, store, position, categories, category_count),
+            rank,
+            start_y + row + 1, start_x,
+            rank == highlight);
 }
 
-static void print_duration_history_list(
-        Interval *intervals,
+static void print_history_list(
+        IntervalStore *store,
+        HistoryRowCache *cache,
+        SortOrder sort,
         Category *categories,
         int category_count,
-        int interval_count,
         int scroll_offset,
         int start_y, int start_x,
         bool reversed,
@@ -562,36 +578,16 @@ static void print_duration_history_list(
         )
 {
     mvhline(start_y, start_x, ACS_HLINE, line_length);
-    if(!reversed)
-        for(int i = 0; i < visible_rows; i++) {
-            int actual_idx = scroll_offset + i;
-            if(actual_idx >= interval_count)
-                break;
-            print_history_item(&intervals[actual_idx],
-                    actual_idx,
-                    categories,
-                    category_count,
-                    start_y + i + 1, start_x,
-                    actual_idx == highlight);
-        }
-    else
-        for(int i = 0; i < visible_rows; i++) {
-            int actual_idx = scroll_offset - i;
-            if(actual_idx < 0)
-                break;
-            print_history_item(&intervals[actual_idx],
-                    actual_idx,
-                    categories,
-                    category_count,
-                    start_y + i + 1, start_x,
-                    actual_idx == highlight);
-        }
+    for(int i = 0; i < visible_rows; i++) {
+        int rank = reversed ? scroll_offset - i : scroll_offset + i;
+        print_history_row(store, cache, sort, categories, category_count,
+                rank, scroll_offset, start_y, start_x, reversed, highlight);
+    }
     mvhline(start_y + visible_rows + 1, start_x, ACS_HLINE, line_length);
 }
 
-static void history_dashboard(Interval *intervals,
+static void history_dashboard(IntervalStore *store,
         Category *categories, 
-        int *interval_count,
         int category_count)
 {
     erase();
@@ -606,6 +602,7 @@ static void history_dashboard(Interval *intervals,
         "[s] Change Sort",
         "[r] Reverse",
         "[d] Delete",
+        "[u] Undo",
         "[Esc] Back"
     };
 
@@ -614,99 +611,129 @@ static void history_dashboard(Interval *intervals,
     int scroll_offset = 0; // Which item is at top of screen
     int highlight = scroll_offset;
 
-    const char *sort_print_options[] = {
-        "Date", "Duration"
+    const char *sort_print_options[sort_orders] = {
+        [sort_date] = "Date",
+        [sort_duration] = "Duration",
+        [sort_category] = "Category"
     };
-    typedef enum sort_logic_options {
-        date, duration
-    } st_logic;
 
-    st_logic curr_sort = date;
-    int sort_max = sizeof(sort_print_options) / sizeof(sort_print_options[0]);
+    SortOrder curr_sort = sort_date;
     bool reversed = false;
 
-    while(1) {
-        attron(A_BOLD);
-        mvprintw(start_y - history_title_spacing, start_x, "HISTORY (%d)", *interval_count);
-        attroff(A_BOLD);
+    // Positions deleted during this visit, most recent last
+    int *undo = NULL;
+    int undo_count = 0;
 
-        action_bar(bar_items, bar_count);
+    HistoryRowCache *cache = malloc(sizeof(HistoryRowCache));
+    if(!cache) {
+        endwin();
+        perror("CRITICAL: Cannot allocate history rows");
+        exit(1);
+    }
+    row_cache_init(cache);
 
-        if(*interval_count == 0) {
+    // What is on screen now; only the highlight rows change when these match
+    bool redraw = true;
+    int drawn_scroll = scroll_offset, drawn_highlight = highlight;
+    SortOrder drawn_sort = curr_sort;
+    bool drawn_reversed = reversed;
+
+    while(1) {
+        if(store_live_count(store) == 0) {
+            attron(A_BOLD);
+            mvprintw(start_y - history_title_spacing, start_x, "HISTORY (%d)", 0);
+            attroff(A_BOLD);
+            action_bar(bar_items, bar_count);
             mvprintw(start_y, start_x, "-- No intervals to display --");
             getch();
+            free(undo);
+            free(cache);
             clear();
             refresh();
             return;
         }
 
-        mvhline(start_y - 1, start_x, ' ', line_length);
-        mvprintw(start_y - 1, start_x, "Sort by: %s (%s)",
-                sort_print_options[curr_sort],
-                reversed ? "desc" : "asc");
-        switch(curr_sort) {
-        case date:
-            print_date_history_list(
-                    intervals,
+        if(redraw || scroll_offset != drawn_scroll || curr_sort != drawn_sort
+                || reversed != drawn_reversed) {
+            attron(A_BOLD);
+            mvprintw(start_y - history_title_spacing, start_x, "HISTORY (%d)", store_live_count(store));
+            attroff(A_BOLD);
+
+            mvhline(start_y - 1, start_x, ' ', line_length);
+            mvprintw(start_y - 1, start_x, "Sort by: %s (%s)",
+                    sort_print_options[curr_sort],
+                    reversed ? "desc" : "asc");
+            print_history_list(
+                    store,
+                    cache,
+                    curr_sort,
                     categories,
                     category_count,
-                    *interval_count,
                     scroll_offset,
                     start_y, start_x,
                     reversed,
                     highlight);
-            break;
-        case duration:
-            print_duration_history_list(
-                    intervals,
-                    categories,
-                    category_count,
-                    *interval_count,
-                    scroll_offset,
-                    start_y, start_x,
-                    reversed,
-                    highlight
-                    );
-            break;
+            action_bar(bar_items, bar_count);
+        }
+        else if(highlight != drawn_highlight) {
+            print_history_row(store, cache, curr_sort, categories, category_count,
+                    drawn_highlight, scroll_offset, start_y, start_x, reversed, highlight);
+            print_history_row(store, cache, curr_sort, categories, category_count,
+                    highlight, scroll_offset, start_y, start_x, reversed, highlight);
+            refresh();
         }
+        redraw = false;
+        drawn_scroll = scroll_offset;
+        drawn_highlight = highlight;
+        drawn_sort = curr_sort;
+        drawn_reversed = reversed;
 
         int key;
       // mvprintw(0, 0, "SCROLLOFFSET: %d    ", scroll_offset);
       // mvprintw(1, 0, "HIGHLIGHT: %d    ", highlight);
         key = getch();
         switch(key) {
-        case CMD_DELETE:
-            delete_interval(intervals, interval_count, highlight);
-            if(highlight >= (*interval_count))
-                highlight = *interval_count - 1;
+        case CMD_DELETE: {
+            int idx = store_ordered(store, curr_sort, highlight);
+            journal_append(journal_delete, &store->items[idx]);
+            delete_interval(store, idx);
+            int *grown = realloc(undo, (size_t)(undo_count + 1) * sizeof(int));
+            if(grown) {
+                undo = grown;
+                undo[undo_count++] = idx;
+            }
+            if(highlight >= (store_live_count(store)))
+                highlight = store_live_count(store) - 1;
             erase(); 
             refresh();
+            redraw = true;
             break;
+        }
         case 'k':
         case KEY_UP:
             if(!reversed) {
-                if(*interval_count > 0 && highlight >= scroll_offset && highlight > 0)
+                if(store_live_count(store) > 0 && highlight >= scroll_offset && highlight > 0)
                     highlight--;
                 if(highlight < scroll_offset && scroll_offset > 0)
                     scroll_offset--;
             }
             else {
-                if(*interval_count > 0 && highlight < *interval_count - 1
+                if(store_live_count(store) > 0 && highlight < store_live_count(store) - 1
                         && highlight <= scroll_offset)
                     highlight++;
-                if(highlight > scroll_offset && scroll_offset < *interval_count - 1)
+                if(highlight > scroll_offset && scroll_offset < store_live_count(store) - 1)
                     scroll_offset++;
             }
             break;
         case KEY_BACKSPACE:
             if(!reversed) {
-                if(*interval_count > 0 && highlight > visible_rows - 1)
+                if(store_live_count(store) > 0 && highlight > visible_rows - 1)
                     highlight -= visible_rows;
                 if(highlight < scroll_offset && scroll_offset > 0)
                     scroll_offset = highlight;
             }
             else {
-                if(*interval_count > 0 && highlight < *interval_count - visible_rows * 2)
+                if(store_live_count(store) > 0 && highlight < store_live_count(store) - visible_rows * 2)
                     highlight += visible_rows;
                 if(highlight > scroll_offset)
                     scroll_offset += visible_rows;
@@ -715,15 +742,15 @@ static void history_dashboard(Interval *intervals,
         case 'j':
         case KEY_DOWN:
             if(!reversed) {
-                if(*interval_count > 0 && highlight < *interval_count - 1
+                if(store_live_count(store) > 0 && highlight < store_live_count(store) - 1
                         && highlight <= visible_rows + scroll_offset - 1)
                     highlight++;
                 if(highlight > visible_rows + scroll_offset - 1
-                        && scroll_offset < *interval_count - visible_rows)
+                        && scroll_offset < store_live_count(store) - visible_rows)
                     scroll_offset++;
             }
             else {
-                if(*interval_count > 0 && highlight > 0 && highlight > scroll_offset - visible_rows)
+                if(store_live_count(store) > 0 && highlight > 0 && highlight > scroll_offset - visible_rows)
                     highlight--;
                 if(highlight <= scroll_offset - visible_rows && scroll_offset - visible_rows >= 0)
                     scroll_offset--;
@@ -731,37 +758,45 @@ static void history_dashboard(Interval *intervals,
             break;
         case key_space:
             if(!reversed) {
-                if(*interval_count > 0 && highlight < *interval_count - visible_rows * 2)
+                if(store_live_count(store) > 0 && highlight < store_live_count(store) - visible_rows * 2)
                     highlight += visible_rows;
                 if(highlight > visible_rows + scroll_offset - 1)
                     scroll_offset += visible_rows;
             }
             else {
-                if(*interval_count > 0 && highlight >= visible_rows * 2)
+                if(store_live_count(store) > 0 && highlight >= visible_rows * 2)
                     highlight -= visible_rows;
                 if(highlight <= scroll_offset - visible_rows && scroll_offset - visible_rows * 2 >= 0)
                     scroll_offset -= visible_rows;
             }
             break;
         case 's':
-            curr_sort = (curr_sort + 1) % sort_max;
-            switch(curr_sort) {
-            case date:
-                qsort(intervals, *interval_count, sizeof(Interval), compare_date);
-                break;
-            case duration:
-                qsort(intervals, *interval_count, sizeof(Interval), compare_duration);
-                break;
-            }
+            // Every order is maintained by the store, switching is free
+            curr_sort = (curr_sort + 1) % sort_orders;
             break;
         case 'r':
             if(!reversed)
-                highlight = scroll_offset = *interval_count - 1;
+                highlight = scroll_offset = store_live_count(store) - 1;
             else
                 highlight = scroll_offset = 0;
             reversed = !reversed;
             break;
+        case CMD_UNDO:
+            if(undo_count > 0) {
+                int idx = undo[--undo_count];
+                restore_interval(store, idx);
+                journal_append(journal_restore, &store->items[idx]);
+                erase();
+                refresh();
+                redraw = true;
+            }
+            break;
         case key_escape:
+            // Positions are stable while here, reclaim tombstones on the way out
+            free(undo);
+            free(cache);
+            if(store_needs_compaction(store))
+                store_compact(store);
             clear();
             refresh();
             return;
@@ -769,7 +804,7 @@ static void history_dashboard(Interval *intervals,
     }
 }
 
-static bool start_interval(Interval *intervals, int *interval_count, Category *categories, int *category_count)
+static bool start_interval(IntervalStore *store, Category *categories, int *category_count)
 {
     clear();
     refresh();
@@ -777,21 +812,10 @@ static bool start_interval(Interval *intervals, int *interval_count, Category *c
     int rows, cols;
     getmaxyx(stdscr, rows, cols);
 
-    char message[100]; // Length of message below
-    int mes_len = snprintf(message, sizeof(message),
-            "Cannot have more than %d intervals.",
-            max_intervals);
-    if(*interval_count >= max_intervals) {
-        mvprintw(rows / 2, (cols - mes_len) / 2, "%s", message);
-        getch();
-        return false;
-    }
-
     int start_y = rows / 2;
     int start_x = cols / 2;
 
-    Interval *current = &intervals[*interval_count];
-
+    int category_idx;
     if(*category_count == 0) {
         mvprintw(start_y, start_x, "Create a category first.");
         getch(); 
@@ -801,328 +825,95 @@ static bool start_interval(Interval *intervals, int *interval_count, Category *c
     }
     else {
         int idx;
-        categories_dashboard(categories, category_count, &idx);
-        if(idx >= 0 && idx < *category_count) current->category_idx = idx;
+        categories_dashboard(store, categories, category_count, &idx);
+        if(idx >= 0 && idx < *category_count) category_idx = categories[idx].id;
         else return false;
     }
    
+    Interval *current = store_append(store);
+    current->category_idx = category_idx;
     current->start = time(NULL);
     current->end = 0;
-    (*interval_count)++;
+    journal_append(journal_start, current);
     return true;
 }
 
-static void get_data_path(char *dest, char *file_name) {
-    const char *home = getenv("HOME");
-    if(home == NULL)
-        strncpy(dest, file_name, PATH_MAX);
-    else
-        snprintf(dest, PATH_MAX, "%s/%s", home, file_name);
-}
-
-static void push(void *attr, size_t size, int count, char *file_name)
-{
-    char path[PATH_MAX];
-    get_data_path(path, file_name);
-
-    FILE *dest = fopen(path, "wb");
-    if(!dest) {
-        endwin();
-        perror("CRITICAL: Cannot to save data");
-        exit(1);
-    }
-
-    size_t transferred_count = fwrite(&count, sizeof(int), 1, dest);
-    size_t transferred_data = fwrite(attr, size, count, dest);
-    if(transferred_data != count || transferred_count != 1) {
-        endwin();
-        perror("CRITICAL: Failde to write data");
-        fclose(dest);
-        exit(1);
-    }
-
-    fclose(dest);
-}
-
-static void pull(void *attr, size_t size, int *count, char *file_name)
-{
-    char path[PATH_MAX];
-    get_data_path(path, file_name);
-
-    FILE *source = fopen(path, "rb");
-    if(!source) {
-        *count = 0;
-        return;
-    }
-
-    fread(count, sizeof(int), 1, source);
-    size_t transferred = fread(attr, size, *count, source);
-    if(transferred != *count) {
-        *count = 0;
-        fclose(source);
-        return;
-    }
-
-    fclose(source);
-}
-
-static void validate_intervals(
-        Interval *intervals,
-        int *interval_count,
-        int category_count)
-{
-    int valid_count = 0;
-    for(int i = 0; i < *interval_count; i++) {
-        Interval *iv = &intervals[i];
-        time_t duration = iv->end - iv->start;
-            if(iv->start == 0 && iv->end == 0)
-                continue;
-            if(iv->end < iv->start)
-                continue;
-            if(duration > hours_in_day * seconds_in_hour)
-                continue;
-            if(iv->category_idx >= 0 && iv->category_idx < category_count) {
-                intervals[valid_count++] = intervals[i];
-            }
-    }
-    *interval_count = valid_count;
-}
-
-static int get_day_total_time(
-        Interval *intervals, Category *categories,
-        int interval_count,
-        int category_count,
-        struct tm t)
-{
-    int total = 0;
-    for(int i = 0; i < interval_count; i++) {
-        if(intervals[i].category_idx > category_count
-                || intervals[i].category_idx < 0)
-            continue;
-        int interval_day = localtime(&intervals[i].start)->tm_yday;
-        int interval_year = localtime(&intervals[i].start)->tm_year;
-        if(interval_day == t.tm_yday && interval_year == t.tm_year) {
-            total += intervals[i].end - intervals[i].start;
-        }
-    }
-    return total;
-}
-
-static int get_month_total_time(
-        Interval *intervals, Category *categories,
-        int interval_count,
-        int category_count,
-        struct tm t)
+static void import_notice(const ImportReport *report)
 {
-    int total = 0;
-    for(int i = 0; i < interval_count; i++) {
-        if(intervals[i].category_idx > category_count
-                || intervals[i].category_idx < 0)
-            continue;
-        int interval_month = localtime(&intervals[i].start)->tm_mon;
-        int interval_year = localtime(&intervals[i].start)->tm_year;
-        if(interval_month == t.tm_mon && interval_year == t.tm_year) {
-            total += intervals[i].end - intervals[i].start;
-        }
-    }
-    return total;
-}
-
-static int get_year_total_time(
-        Interval *intervals, Category *categories,
-        int interval_count,
-        int category_count,
-        struct tm t)
-{
-    int total = 0;
-    for(int i = 0; i < interval_count; i++) {
-        if(intervals[i].category_idx > category_count
-                || intervals[i].category_idx < 0)
-            continue;
-        int interval_year = localtime(&intervals[i].start)->tm_year;
-        if(interval_year == t.tm_year) {
-            total += intervals[i].end - intervals[i].start;
-        }
-    }
-    return total;
-}
-
-static int get_week_monday(struct tm *dynamic_t)
-{
-    int days_since_monday = (dynamic_t->tm_wday + days_in_week - 1) % days_in_week;
-    struct tm monday = *dynamic_t;
-    monday.tm_mday -= days_since_monday;
-    mktime(&monday); 
-    return monday.tm_yday;
-}
-
-static int get_week_total_time(
-        Interval *intervals, Category *categories,
-        int interval_count,
-        int category_count,
-        struct tm t)
-{
-    int total = 0;
-    int monday = get_week_monday(&t);
-    for(int i = 0; i < interval_count; i++) {
-        if(intervals[i].category_idx > category_count
-                || intervals[i].category_idx < 0)
-            continue;
-        int interval_start_day = localtime(&intervals[i].start)->tm_yday;
-        int interval_year = localtime(&intervals[i].start)->tm_year;
-        if(interval_start_day >= monday
-                && interval_year == t.tm_year
-                && interval_start_day <= monday + days_in_week - 1) {
-            total += intervals[i].end - intervals[i].start;
-        }
-    }
-    return total;
-}
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    WINDOW *win = newwin(confirm_height, confirm_width,
+            (rows - confirm_height) / 2, (cols - confirm_width) / 2);
+    box(win, 0, 0);
 
-void static append_category(
-        Category *categories,
-        int *category_count,
-        char category_name[name_max_length])
-{
-    strncpy(categories[*category_count].name,
-            category_name, name_max_length - 1);
-    categories[*category_count].name[name_max_length - 1] = '\0';
-    (*category_count)++;
-}
+    char line[confirm_width];
+    int len = snprintf(line, sizeof(line) - 2, " %s ", report->file);
+    wattron(win, A_BOLD);
+    mvwaddstr(win, 1, (confirm_width - len) / 2, line);
+    wattroff(win, A_BOLD);
 
-static bool category_exists(
-        Category *categories,
-        int total,
-        char target[name_max_length],
-        int *idx
-        )
-{
-    for(int i = 0; i < total; i++) {
-        if(strcmp(categories[i].name, target) == 0) {
-            *idx = i;
-            return true;
+    if(!report->format) {
+        len = snprintf(line, sizeof(line), "Unrecognized format, not imported");
+        mvwaddstr(win, 3, (confirm_width - len) / 2, line);
+    } else {
+        len = snprintf(line, sizeof(line), "Imported %d sessions from %s",
+                report->imported, report->format);
+        mvwaddstr(win, 3, (confirm_width - len) / 2, line);
+        if(report->skipped > 0)
+            len = snprintf(line, sizeof(line), "Skipped %d bad rows (first: row %d)",
+                    report->skipped, report->first_skipped_row);
+        else
+            len = snprintf(line, sizeof(line), "%.0f rows/s",
+                    (report->imported + report->skipped + report->duplicates)
+                    / (report->seconds > 0 ? report->seconds : 1e-9));
+        mvwaddstr(win, 4, (confirm_width - len) / 2, line);
+        if(report->duplicates > 0) {
+            len = snprintf(line, sizeof(line), "%d already present", report->duplicates);
+            mvwaddstr(win, 5, (confirm_width - len) / 2, line);
         }
     }
-    *idx = total;
-    return false;
-}
-
-static void parse_forest_data(
-        Interval *intervals,
-        Category *categories,
-        int *interval_count,
-        int *category_count)
-{
-    char path[PATH_MAX];
-    get_data_path(path, FOREST_FILE);
 
-    FILE *source = fopen(path, "r");
-    if(!source) {
-        return;
-    }
-    char line[512]; // Plenty of space for string
-
-    fgets(line, sizeof(line), source); // Skip header line
-    while(fgets(line, sizeof(line), source) && *interval_count < max_intervals) {
-        struct tm start = {0}, end = {0};
-        int start_year, start_mon, end_year, end_mon;
-        char category_name[name_max_length];
-
-        Interval *interval = &intervals[*interval_count];
-
-        int parsed = sscanf(
-                line,
-                "%d-%d-%dT%d:%d:%d%*[^,],%d-%d-%dT%d:%d:%d%*[^,],%[^,]",
-                &start_year, &start_mon, &start.tm_mday,
-                &start.tm_hour, &start.tm_min,
-                &start.tm_sec, &end_year, &end_mon,
-                &end.tm_mday, &end.tm_hour,
-                &end.tm_min, &end.tm_sec,
-                category_name);
-        if(parsed == forest_values) {
-            start.tm_year = start_year - 1900;
-            start.tm_mon = start_mon - 1;
-            start.tm_isdst = -1;
-
-            end.tm_year = end_year - 1900;
-            end.tm_mon = end_mon - 1;
-            end.tm_isdst = -1;
-
-            int ctgr_idx;
-            if(!category_exists(categories, *category_count, category_name, &ctgr_idx))
-                append_category(categories, category_count, category_name);
-
-            interval->start = mktime(&start);
-            interval->end = mktime(&end);
-            interval->category_idx = ctgr_idx;
-            (*interval_count)++;
-        }
-        else {
-            mvprintw(0, 0, "Error: failed to parse timestamp (got %d/%d fields)\n",
-                    parsed, forest_values);
-            break;
-        }
-    }
+    char hint[] = "Press any key";
+    wattron(win, COLOR_PAIR(3));
+    mvwaddstr(win, 6, (confirm_width - strlen(hint)) / 2, hint);
+    wattroff(win, COLOR_PAIR(3));
 
-    fclose(source);
+    wgetch(win);
+    delwin(win);
+    clear();
+    refresh();
 }
 
-typedef int (*get_total_func)(Interval*, Category*, int, int, struct tm);
 typedef void(*update_time)(struct tm*, struct tm*, int);
-typedef int(*get_total_target)(struct tm*);
 typedef void(*display_date_line)(struct tm*, int, int);
-typedef int(*get_interval_target)(Interval *interval);
-
-static int get_interval_day(Interval *interval)
-{
-    return localtime(&interval->start)->tm_yday; 
-}
-
-static int get_interval_month(Interval *interval)
-{
-    return localtime(&interval->start)->tm_mon; 
-}
 
-static int get_interval_year(Interval *interval)
-{
-    return localtime(&interval->start)->tm_year; 
-}
-
-static void get_distribution(Interval *intervals,
+static void get_distribution(DayRollup *rollup,
         Category *categories,
-        int interval_count,
         int category_count,
-        int target,
-        struct tm dynamic_t,
-        int y, int x,
-        get_interval_target get_target)
+        int first_day, int last_day,
+        int y, int x)
 {
     typedef struct Pair {
         char category[name_max_length];
         int total;
     } Pair;
 
-    Pair pairs[category_count];
+    Pair pairs[category_count + 1];
 
     int cols = getmaxx(stdscr);
 
-    // Copy category names
+    // Copy category names and sum their day buckets, deleted ones last
     for(int i = 0; i < category_count; i++) {
         strncpy(pairs[i].category, categories[i].name, name_max_length);
-        pairs[i].total = 0;
-    }
-
-    // Find total for each category in a given timeline
-    for(int i = 0; i < interval_count; i++) {
-        Interval *interval = &intervals[i];
-        int interval_timeline = get_target(interval);
-        if(interval_timeline == target)
-            pairs[interval->category_idx].total += interval->end - interval->start;
+        pairs[i].total = rollup_category_total(rollup, i, first_day, last_day);
     }
+    strncpy(pairs[category_count].category, DELETED_CATEGORY, name_max_length);
+    pairs[category_count].total = rollup_category_total(rollup, deleted_category,
+            first_day, last_day);
 
     // Print "Category: total_mins/total_secs
     int print_y = y;
-    for(int i = 0; i < category_count; i++) {
+    for(int i = 0; i <= category_count; i++) {
         mvhline(y + i, x - 1, ' ', cols - x);
         if(pairs[i].total <= 0)
             continue;
@@ -1137,23 +928,17 @@ static void get_distribution(Interval *intervals,
         else
             mvprintw(print_y, x, "%s: %dh%dm",
                     pairs[i].category, mins_focused / minutes_in_hour,
-                    mins_focused & minutes_in_hour);
+                    mins_focused % minutes_in_hour);
         attroff(COLOR_PAIR(3));
 
         print_y++;
     }
 }
 
-static int get_yday(struct tm *dynamic_t) { return dynamic_t->tm_yday; }
-
-static int get_month(struct tm *dynamic_t) { return dynamic_t->tm_mon; }
-
-static int get_year(struct tm *dynamic_t) { return dynamic_t->tm_year; }
-
 static void update_year(struct tm *dynamic_t, struct tm *t, int step)
 {
     dynamic_t->tm_year += step;
-    mktime(dynamic_t);
+    local_mktime(dynamic_t);
     if(step > 0 && dynamic_t->tm_year > t->tm_year)
         (dynamic_t->tm_year) -= step;
 }
@@ -1161,7 +946,7 @@ static void update_year(struct tm *dynamic_t, struct tm *t, int step)
 static void update_month(struct tm *dynamic_t, struct tm *t, int step)
 {
     dynamic_t->tm_mon += step;
-    mktime(dynamic_t);
+    local_mktime(dynamic_t);
     if(step > 0 && dynamic_t->tm_year == t->tm_year
             && dynamic_t->tm_mon > t->tm_mon)
         (dynamic_t->tm_mon) -= step;
@@ -1170,7 +955,7 @@ static void update_month(struct tm *dynamic_t, struct tm *t, int step)
 static void update_day(struct tm *dynamic_t, struct tm *t, int step)
 {
     dynamic_t->tm_mday += step;
-    mktime(dynamic_t);
+    local_mktime(dynamic_t);
     if(dynamic_t->tm_yday > t->tm_yday 
             && dynamic_t->tm_year == t->tm_year)
         (dynamic_t->tm_mday) -= step;
@@ -1179,7 +964,7 @@ static void update_day(struct tm *dynamic_t, struct tm *t, int step)
 static void update_week(struct tm *dynamic_t, struct tm *t, int step)
 {
     dynamic_t->tm_mday += step * days_in_week;
-    mktime(dynamic_t);
+    local_mktime(dynamic_t);
     if(dynamic_t->tm_yday > t->tm_yday 
             && dynamic_t->tm_year == t->tm_year)
         dynamic_t->tm_mday -= step * days_in_week;
@@ -1223,8 +1008,8 @@ static void display_week_line(struct tm *dynamic_t, int y, int col)
 
     monday.tm_mday -= days_since_monday;
     sunday.tm_mday += days_until_sunday;
-    mktime(&sunday);
-    mktime(&monday);
+    local_mktime(&sunday);
+    local_mktime(&monday);
 
     char buff[50];
     int len = snprintf(buff, sizeof(buff),"<- %02d/%02d-%02d/%02d ->",
@@ -1235,22 +1020,44 @@ static void display_week_line(struct tm *dynamic_t, int y, int col)
     attroff(COLOR_PAIR(3));
 }
 
+// Prints the centered "Total: ..." line and returns its length
+static int print_total_line(int total, int y, int col)
+{
+    char total_buff[50];
+    int total_buff_len;
+    if(total / seconds_in_minute < minutes_in_hour)
+        total_buff_len = snprintf(total_buff,
+                sizeof(total_buff),
+                "Total: %dm%ds",
+                total / seconds_in_minute,
+                total % seconds_in_minute);
+    else
+        total_buff_len = snprintf(total_buff,
+                sizeof(total_buff),
+                "Total: %dh%dm",
+                total / seconds_in_hour,
+                total % seconds_in_hour / seconds_in_minute);
+    attron(COLOR_PAIR(9));
+    mvhline(y, 0, ' ', col);
+    mvaddstr(y, (col - total_buff_len) / 2, total_buff);
+    attroff(COLOR_PAIR(9));
+    return total_buff_len;
+}
+
 static void stats(
-        Interval *intervals,
+        IntervalStore *store,
         Category *categories,
-        int interval_count,
         int category_count,
         const char *title,
         display_date_line display_line,
-        get_total_target get_target,
-        get_interval_target get_int_target,
-        update_time update_tm,
-        get_total_func get_total)
+        get_period get_range,
+        update_time update_tm)
 {
     erase();
     refresh();
     time_t now = time(NULL);
-    struct tm t = *localtime(&now);
+    struct tm t;
+    local_civil(now, &t);
     struct tm dynamic_t = t;
 
     int row, col;
@@ -1258,12 +1065,12 @@ static void stats(
     int y = (row - bar_height) / 2;
 
     while(1) {
-        mktime(&dynamic_t);
-        int total = get_total(intervals,
-                categories,
-                interval_count,
-                category_count,
-                dynamic_t);
+        local_mktime(&dynamic_t);
+        int first_day, last_day;
+        get_range(&dynamic_t, &first_day, &last_day);
+        int total = get_period_total(&store->rollup, category_count, first_day, last_day);
+        int sessions = store_count_between(store,
+                day_start(first_day), day_start(last_day + 1));
 
         char stats_buff[100]; // Plenty of space for string
         int buff_len = snprintf(stats_buff, sizeof(stats_buff),
@@ -1275,34 +1082,22 @@ static void stats(
 
         display_line(&dynamic_t, y + 2, col);
 
-        char total_buff[50];
-        int total_buff_len;
-        if(total / seconds_in_minute < minutes_in_hour)
-            total_buff_len = snprintf(total_buff,
-                    sizeof(total_buff),
-                    "Total: %dm%ds",
-                    total / seconds_in_minute,
-                    total % seconds_in_minute);
-        else
-            total_buff_len = snprintf(total_buff,
-                    sizeof(total_buff),
-                    "Total: %dh%dm",
-                    total / seconds_in_hour,
-                    total % seconds_in_hour / seconds_in_minute);
-        attron(COLOR_PAIR(9));
-        mvhline(y + 4, 0, ' ', col);
-        mvaddstr(y + 4, (col - total_buff_len) / 2, total_buff);
-        attroff(COLOR_PAIR(9));
+        int total_buff_len = print_total_line(total, y + 4, col);
+
+        char sessions_buff[50];
+        int sessions_len = snprintf(sessions_buff, sizeof(sessions_buff),
+                "Sessions: %d", sessions);
+        attron(COLOR_PAIR(3));
+        mvhline(y + 5, 0, ' ', col);
+        mvaddstr(y + 5, (col - sessions_len) / 2, sessions_buff);
+        attroff(COLOR_PAIR(3));
 
         get_distribution(
-                intervals,
+                &store->rollup,
                 categories,
-                interval_count,
                 category_count,
-                get_target(&dynamic_t),
-                dynamic_t, 
-                y + 6, (col - total_buff_len) / 2,
-                get_int_target);
+                first_day, last_day,
+                y + 6, (col - total_buff_len) / 2);
         
         refresh();
 
@@ -1324,9 +1119,97 @@ static void stats(
     }
 }
 
+// Reads a DD/MM/YYYY date below a prompt, returns false on Esc
+static bool get_date_input(const char *prompt, int *day_number, struct tm *date)
+{
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    while(1) {
+        erase();
+        attron(A_BOLD);
+        mvaddstr((rows - text_input_height) / 2 - 1,
+                (cols - strlen(prompt)) / 2, prompt);
+        attroff(A_BOLD);
+        refresh();
+
+        char buffer[name_max_length] = {0};
+        if(!get_text_input(buffer, date_input_length + 1))
+            return false;
+
+        int day, month, year;
+        if(sscanf(buffer, "%d/%d/%d", &day, &month, &year) != 3
+                || month < 1 || month > months_in_year || day < 1)
+            continue;
+
+        // Reject days past the end of the month
+        int last = month == months_in_year
+            ? days_from_civil(year + 1, 1, 1) - 1
+            : days_from_civil(year, month + 1, 1) - 1;
+        *day_number = days_from_civil(year, month, day);
+        if(*day_number > last)
+            continue;
+
+        *date = (struct tm){ .tm_mday = day, .tm_mon = month - 1, .tm_year = year - 1900 };
+        return true;
+    }
+}
+
+static void range_stats(DayRollup *rollup,
+        Category *categories,
+        int category_count)
+{
+    int first_day, last_day;
+    struct tm from, to;
+    if(!get_date_input("FROM (DD/MM/YYYY)", &first_day, &from)
+            || !get_date_input("TO (DD/MM/YYYY)", &last_day, &to)) {
+        erase();
+        refresh();
+        return;
+    }
+    if(first_day > last_day) {
+        int swap_day = first_day;
+        first_day = last_day;
+        last_day = swap_day;
+        struct tm swap_tm = from;
+        from = to;
+        to = swap_tm;
+    }
+
+    erase();
+    int row, col;
+    getmaxyx(stdscr, row, col);
+    int y = (row - bar_height) / 2;
+
+    const char title[] = "RANGE STATS";
+    attron(A_BOLD);
+    mvaddstr(y, (col - strlen(title)) / 2, title);
+    attroff(A_BOLD);
+
+    char buff[50];
+    int len = snprintf(buff, sizeof(buff), "%02d/%02d/%d - %02d/%02d/%d",
+            from.tm_mday, from.tm_mon + 1, from.tm_year + 1900,
+            to.tm_mday, to.tm_mon + 1, to.tm_year + 1900);
+    attron(COLOR_PAIR(3));
+    mvaddstr(y + 2, (col - len) / 2, buff);
+    attroff(COLOR_PAIR(3));
+
+    int total = get_period_total(rollup, category_count, first_day, last_day);
+    int total_buff_len = print_total_line(total, y + 4, col);
+    get_distribution(rollup, categories, category_count,
+            first_day, last_day,
+            y + 6, (col - total_buff_len) / 2);
+    refresh();
+
+    while(getch() != key_escape)
+        ;
+    erase();
+    refresh();
+}
+
 static void statistics_screen(
-        Interval *intervals, Category *categories,
-        int interval_count, int category_count)
+        IntervalStore *store, Category *categories,
+        int category_count)
 {
     erase();
     refresh();
@@ -1336,6 +1219,7 @@ static void statistics_screen(
         "[m] Month",
         "[y] Year",
         "[w] Week",
+        "[r] Range",
         "[Esc] Exit"
     };
 
@@ -1362,32 +1246,27 @@ static void statistics_screen(
         int key = getch();
         switch(key) {
             case 'd':
-                stats(intervals, categories,
-                        interval_count, category_count,
+                stats(store, categories, category_count,
                         DAY_TITLE, display_day_line,
-                        get_yday, get_interval_day,
-                        update_day, get_day_total_time);
+                        get_day_period, update_day);
                 break;
             case 'm':
-                stats(intervals, categories,
-                        interval_count, category_count,
+                stats(store, categories, category_count,
                         month_title, display_month_line,
-                        get_month, get_interval_month,
-                        update_month, get_month_total_time);
+                        get_month_period, update_month);
                 break;
             case 'y':
-                stats(intervals, categories,
-                        interval_count, category_count,
+                stats(store, categories, category_count,
                         year_title, display_year_line,
-                        get_year, get_interval_year,
-                        update_year, get_year_total_time);
+                        get_year_period, update_year);
                 break;
             case 'w':
-                stats(intervals, categories,
-                        interval_count, category_count,
+                stats(store, categories, category_count,
                         week_title, display_week_line,
-                        get_week_monday, get_interval_day,
-                        update_week, get_week_total_time);
+                        get_week_period, update_week);
+                break;
+            case 'r':
+                range_stats(&store->rollup, categories, category_count);
                 break;
             case key_escape:
                 erase();
@@ -1401,7 +1280,6 @@ static void force_end(WINDOW *win, int height, int width)
 {
     werase(win);
     wrefresh(win);
-    timeout(-1);
 
     box(win, 0, 0); 
 
@@ -1418,12 +1296,85 @@ static void force_end(WINDOW *win, int height, int width)
     wattroff(win, COLOR_PAIR(3));
 
     wgetch(win);
-    timeout(default_timeout);
 }
 
-static void active_screen(Interval *interval,
+// Fires on wall-clock second boundaries while the timer is on screen
+static int tick_fd = -1;
+
+static void tick_start(void)
+{
+#ifdef __linux__
+    if(tick_fd < 0)
+        tick_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    if(tick_fd < 0)
+        return; // wait_key falls back to poll timeouts
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = 1 },
+        .it_value = { .tv_sec = now.tv_sec + 1 },
+    };
+    timerfd_settime(tick_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+#endif
+}
+
+static void tick_stop(void)
+{
+#ifdef __linux__
+    if(tick_fd < 0)
+        return;
+    struct itimerspec disarm = {0};
+    timerfd_settime(tick_fd, 0, &disarm, NULL);
+#endif
+}
+
+static int ms_to_next_second(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return 1000 - now.tv_nsec / 1000000;
+}
+
+// Blocks until a key arrives. With ticking set it also returns ERR once per
+// wall-clock second, keypresses do not move the cadence.
+static int wait_key(bool ticking)
+{
+    if(!ticking) {
+        timeout(-1);
+        return getch();
+    }
+
+    // Drain what curses already buffered before sleeping on the descriptor
+    timeout(0);
+    int key;
+    while((key = getch()) == ERR) {
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = tick_fd, .events = POLLIN },
+        };
+        int ready = poll(fds, tick_fd >= 0 ? 2 : 1,
+                tick_fd >= 0 ? -1 : ms_to_next_second());
+        if(ready < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(ready == 0)
+            break;
+        if(tick_fd >= 0 && (fds[1].revents & POLLIN)) {
+            uint64_t expirations;
+            if(read(tick_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                continue; // Spurious wakeup
+            break;
+        }
+    }
+    timeout(-1);
+    return key;
+}
+
+static void active_screen(IntervalStore *store,
         Category *categories,
-        int *interval_count,
         int category_count)
 {
     int rows, cols;
@@ -1438,49 +1389,177 @@ static void active_screen(Interval *interval,
 
     WINDOW *win = newwin(active_height, active_width, start_y, start_x);
     keypad(win, TRUE);
+
+    Interval *interval = &store->items[store->count - 1];
+    ActiveView view = {0};
+    tick_start();
     
     while(1) {
-        erase();
-        refresh();
-
-        box(win, 0, 0); 
+        size_t queued = 0;
+        if(!view.framed) {
+            erase();
+            wnoutrefresh(stdscr);
+            werase(win);
+            print_active_frame(win, &view, interval, categories, active_width, category_count);
+            queued += (size_t)active_height * active_width;
+        }
         interval->end = time(NULL);
-        print_time(win, interval, categories, active_height, active_width, category_count);
+        queued += print_time(win, &view, interval, active_height, active_width);
+        // Batch both windows into a single terminal write
+        wnoutrefresh(win);
+        doupdate();
+
+        render_stats.ticks++;
+        render_stats.queued += queued;
+        render_stats.repainted += (size_t)active_height * active_width;
 
         if(interval->end - interval->start >= max_time * seconds_in_minute) {
+            // A resumed session may be long past the limit
+            interval->end = interval->start + max_time * seconds_in_minute;
+            journal_append(journal_end, interval);
+            store_close_interval(store, interval);
+            tick_stop();
             force_end(win, active_height, active_width);
             delwin(win);
             return;
         }
 
-        int key = getch();
+        int key = wait_key(true);
         if(key == key_escape || key == 'q') {
             if(interval->end - interval->start < min_time) {
                 if(confirm_action(print_exit_query, giveup_msg)) {
-                    (*interval_count)--; // Deleting
+                    journal_append(journal_discard, interval);
+                    store->count--; // Deleting
+                    tick_stop();
                     delwin(win);
                     return;
                 }
             } else if(confirm_action(print_exit_query, stop_msg)) {
+                journal_append(journal_end, interval);
+                store_close_interval(store, interval);
+                tick_stop();
                 delwin(win);
                 return;
             }
+            // The dialog cleared the screen
+            view.framed = false;
         }
     }
 }
 
-static void main_screen(Interval *intervals,
-        int *interval_count,
+static void export_screen(IntervalStore *store,
         Category *categories,
-        int *category_count)
+        int category_count)
 {
-    timeout(-1);
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    clear();
+    refresh();
+    WINDOW *win = newwin(confirm_height, confirm_width,
+            (rows - confirm_height) / 2, (cols - confirm_width) / 2);
+    keypad(win, TRUE);
+    box(win, 0, 0);
+
+    wattron(win, COLOR_PAIR(3));
+    mvwprintw(win, 1, esc_hint_padding, ESC_HINT);
+    wattroff(win, COLOR_PAIR(3));
+
+    char title[] = " EXPORT ";
+    wattron(win, A_BOLD);
+    mvwaddstr(win, 1, (confirm_width - strlen(title)) / 2, title);
+    wattroff(win, A_BOLD);
+
+    char options[] = "[c] CSV   [j] JSON   [n] NDJSON";
+    mvwaddstr(win, 4, (confirm_width - strlen(options)) / 2, options);
+    wrefresh(win);
 
+    ExportFormat format = export_formats;
+    while(format == export_formats) {
+        int key = wgetch(win);
+        if(key == 'c')
+            format = export_csv;
+        else if(key == 'j')
+            format = export_json;
+        else if(key == 'n')
+            format = export_ndjson;
+        else if(key == key_escape)
+            break;
+    }
+
+    if(format != export_formats) {
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        int sessions = 0, days = 0;
+        bool ok = export_files(format, store, categories, category_count, &sessions, &days);
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        double seconds = (finished.tv_sec - started.tv_sec)
+            + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+        char line[confirm_width];
+        int len;
+        mvwhline(win, 4, 1, ' ', confirm_width - 2);
+        if(ok) {
+            len = snprintf(line, sizeof(line), "%d sessions, %d day rows", sessions, days);
+            mvwaddstr(win, 3, (confirm_width - len) / 2, line);
+            len = snprintf(line, sizeof(line), "~/%s.%s in %.2fs",
+                    EXPORT_SESSIONS, export_extensions[format], seconds);
+            mvwaddstr(win, 4, (confirm_width - len) / 2, line);
+        } else {
+            len = snprintf(line, sizeof(line), "Export failed: %s", strerror(errno));
+            mvwaddstr(win, 4, (confirm_width - len) / 2, line);
+        }
+        char hint[] = "Press any key";
+        wattron(win, COLOR_PAIR(3));
+        mvwaddstr(win, 6, (confirm_width - strlen(hint)) / 2, hint);
+        wattroff(win, COLOR_PAIR(3));
+        wrefresh(win);
+        wgetch(win);
+    }
+
+    delwin(win);
+    clear();
+    refresh();
+}
+
+// Waits for the background load if it is still running, then shows
+// what it imported. Returns true if anything was shown.
+static bool finish_loading(StoreLoader **loader, IntervalStore *recent)
+{
+    if(!*loader)
+        return false;
+    if(!loader_done(*loader)) {
+        char msg[] = "Loading history...";
+        int row, col;
+        getmaxyx(stdscr, row, col);
+        mvaddstr(row - bar_height - 1, (col - strlen(msg)) / 2, msg);
+        refresh();
+    }
+    int report_count;
+    ImportReport *reports = loader_finish(*loader, &report_count);
+    move(getmaxy(stdscr) - bar_height - 1, 0);
+    clrtoeol();
+    refresh();
+    *loader = NULL;
+    store_free(recent);
+    for(int i = 0; i < report_count; i++)
+        import_notice(&reports[i]);
+    free(reports);
+    return report_count > 0;
+}
+
+static void main_screen(IntervalStore *store,
+        IntervalStore *recent,
+        StoreLoader **loader,
+        Category *categories,
+        int *category_count,
+        int recent_categories)
+{
     static const char *bar_items[] = {
         "[s] Start",
         "[c] Categories",
         "[h] History",
         "[t] Stats",
+        "[e] Export",
         "[Esc] Exit"
     };
 
@@ -1492,6 +1571,9 @@ static void main_screen(Interval *intervals,
     int start_y = (row - bar_height) / 2;
 
     time_t now = time(NULL);
+    // The loader may still be appending imported categories; the count
+    // is only read once finish_loading() has joined it
+    int shown_categories = *loader ? recent_categories : *category_count;
 
     while(1) {
         char main_screen_buffer[] = "MAIN SCREEN";
@@ -1501,12 +1583,12 @@ static void main_screen(Interval *intervals,
                 main_screen_buffer);
         attroff(A_BOLD);
 
-        struct tm t = *localtime(&now);
-        int day_total = get_day_total_time(intervals,
-                categories,
-                *interval_count,
-                *category_count,
-                t);
+        struct tm t;
+        local_civil(now, &t);
+        int today = tm_day_number(&t);
+        // Until the full history is in, the recent store has today's sessions
+        DayRollup *rollup = *loader ? &recent->rollup : &store->rollup;
+        int day_total = get_period_total(rollup, shown_categories, today, today);
         int mins_total = day_total / seconds_in_minute; 
         int secs_total = day_total % seconds_in_minute;
 
@@ -1519,39 +1601,45 @@ static void main_screen(Interval *intervals,
 
         action_bar(bar_items, bar_count);
 
-        int key = getch();
+        int key = wait_key(false);
+        if(finish_loading(loader, recent))
+            continue; // Import notices took the key press
+        shown_categories = *category_count;
         switch(key) {
         case CMD_START:
-            if(start_interval(intervals, interval_count, 
-                        categories, category_count)) {
-                timeout(default_timeout);
-                active_screen (
-                        &intervals[*interval_count - 1],
-                        categories,
-                        interval_count,
-                        *category_count);
-                timeout(-1);
+            if(start_interval(store, categories, category_count)) {
+                active_screen(store, categories, *category_count);
+                if(journal_size() >= journal_compact_threshold)
+                    compact_journal(store);
                 erase();
                 refresh();
             }
             break;
         case CMD_CATEGORY:
             int option;
-            categories_dashboard(categories, category_count, &option);
+            categories_dashboard(store, categories, category_count, &option);
             break;
         case CMD_HISTORY:
-            history_dashboard(intervals, categories,
-                    interval_count, *category_count);
+            history_dashboard(store, categories, *category_count);
             break;
         case CMD_STATS:
-            statistics_screen(intervals, categories, *interval_count, *category_count);
+            statistics_screen(store, categories, *category_count);
+            break;
+        case CMD_EXPORT:
+            export_screen(store, categories, *category_count);
             break;
         case key_escape:
-            push(categories, sizeof(Category),
-                    *category_count, CATEGORIES_FILE);
-            push(intervals, sizeof(Interval),
-                    *interval_count, INTERVALS_FILE);
+            // Every event is already journaled, so only fold it in when due
+            if(journal_size() >= journal_compact_threshold)
+                compact_journal(store);
+            store_free(store);
             endwin();
+            if(getenv("TM_RENDER_STATS") && render_stats.ticks > 0)
+                fprintf(stderr, "active screen: %ld ticks, %zu cells queued, "
+                        "%zu for full repaints (%.1f vs %.1f per tick)\n",
+                        render_stats.ticks, render_stats.queued, render_stats.repainted,
+                        (double)render_stats.queued / render_stats.ticks,
+                        (double)render_stats.repainted / render_stats.ticks);
             exit(0);
         }
     }
@@ -1586,24 +1674,325 @@ static void init_colors()
     }
 }
 
-static bool file_exists(const char *filename)
+
+// Headless commands, run without ever initializing curses
+
+// The checks validate_intervals applies, for commands that skip it
+static bool cli_counts(const Interval *iv)
 {
-    FILE *file = fopen(filename, "r");
-    if(file) {
-        fclose(file);
-        return true;
+    return !is_deleted(iv) && iv->end != 0 && iv->end >= iv->start
+        && iv->end - iv->start <= hours_in_day * seconds_in_hour
+        && iv->category_idx >= 0 && iv->category_idx < max_category_ids;
+}
+
+// Reads the months from since on, or every segment when since is 0,
+// plus the journal. Nothing is rewritten.
+static void cli_load(IntervalStore *store, Category *categories, int *category_count,
+        time_t since)
+{
+    pull_categories(categories, category_count);
+    if(since)
+        pull_recent_intervals(store, since);
+    else
+        pull_intervals(store);
+    store_sort(store);
+    replay_journal(store);
+    rollup_map_categories(&store->rollup, categories, *category_count);
+}
+
+// Local midnight that started today
+static time_t today_start(void)
+{
+    struct tm t;
+    local_civil(time(NULL), &t);
+    return day_start(tm_day_number(&t));
+}
+
+static void print_clock(time_t timestamp)
+{
+    struct tm t;
+    local_civil(timestamp, &t);
+    printf("%02d:%02d", t.tm_hour, t.tm_min);
+}
+
+static void print_duration(const char *label, int seconds)
+{
+    printf("%-*s %dm%ds\n", name_max_length, label,
+            seconds / seconds_in_minute, seconds % seconds_in_minute);
+}
+
+// Sums sessions starting in [first_day, last_day]. The store is sorted by
+// start, so only that slice of it is read.
+static int cli_period(IntervalStore *store,
+        int first_day, int last_day, DayTotals totals)
+{
+    memset(totals, 0, sizeof(DayTotals));
+    int from = store_lower_bound(store, day_start(first_day));
+    int to = store_lower_bound(store, day_start(last_day + 1));
+    int sessions = 0;
+    for(int i = from; i < to; i++) {
+        Interval *iv = &store->items[i];
+        if(!cli_counts(iv))
+            continue;
+        totals[category_slot(&store->rollup, iv->category_idx)] += iv->end - iv->start;
+        sessions++;
+    }
+    return sessions;
+}
+
+static void cli_print_period(const char *title, int first_day, int last_day,
+        Category *categories, int category_count, DayTotals totals, int sessions)
+{
+    int year, month, day;
+    civil_from_days(first_day, &year, &month, &day);
+    printf("%s %02d/%02d/%d", title, day, month, year);
+    if(last_day != first_day) {
+        civil_from_days(last_day, &year, &month, &day);
+        printf(" - %02d/%02d/%d", day, month, year);
+    }
+    printf("\n");
+
+    int total = 0;
+    for(int c = 0; c <= category_count; c++) {
+        int slot = c < category_count ? c : deleted_category;
+        if(totals[slot] == 0)
+            continue;
+        print_duration(slot == deleted_category ? DELETED_CATEGORY : categories[slot].name,
+                totals[slot]);
+        total += totals[slot];
+    }
+    print_duration("Total", total);
+    printf("Sessions: %d\n", sessions);
+}
+
+static int cli_stats_period(get_period get_range, const char *title, bool whole)
+{
+    struct tm now;
+    local_civil(time(NULL), &now);
+    int first_day, last_day;
+    get_range(&now, &first_day, &last_day);
+
+    Category categories[max_categories];
+    int category_count = 0;
+    IntervalStore store = {0};
+    cli_load(&store, categories, &category_count, whole ? 0 : day_start(first_day));
+
+    DayTotals totals;
+    int sessions = cli_period(&store, first_day, last_day, totals);
+    cli_print_period(title, first_day, last_day, categories, category_count, totals, sessions);
+
+    Interval *running = open_session(&store);
+    if(running) {
+        printf("Running: %s since ",
+                category_label(categories, category_count, running->category_idx));
+        print_clock(running->start);
+        printf("\n");
     }
-    return false;
+    store_free(&store);
+    return 0;
 }
 
-static void create_file(const char *filename)
+static int cli_today(int argc, char **argv)
 {
-    FILE *file = fopen(filename, "w");
-    if(file)
-        fclose(file);
+    (void)argc;
+    (void)argv;
+    return cli_stats_period(get_day_period, "Today", false);
 }
 
-int main() {
+static int cli_stats(int argc, char **argv)
+{
+    static const struct {
+        const char *flag;
+        const char *title;
+        get_period get_range;
+        bool whole; // Reads every segment rather than from the first day
+    } periods[] = {
+        { "--day", "Day", get_day_period, false },
+        { "--week", "Week", get_week_period, false },
+        { "--month", "Month", get_month_period, false },
+        { "--year", "Year", get_year_period, true },
+    };
+
+    int chosen = 1; // Week unless asked otherwise
+    for(int i = 1; i < argc; i++) {
+        chosen = -1;
+        for(size_t p = 0; p < sizeof(periods) / sizeof(periods[0]); p++)
+            if(strcmp(argv[i], periods[p].flag) == 0)
+                chosen = (int)p;
+        if(chosen < 0) {
+            fprintf(stderr, "stats: unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    return cli_stats_period(periods[chosen].get_range, periods[chosen].title,
+            periods[chosen].whole);
+}
+
+static int cli_export(int argc, char **argv)
+{
+    ExportFormat format = export_csv;
+    bool days = false;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--csv") == 0)
+            format = export_csv;
+        else if(strcmp(argv[i], "--json") == 0)
+            format = export_json;
+        else if(strcmp(argv[i], "--ndjson") == 0)
+            format = export_ndjson;
+        else if(strcmp(argv[i], "--days") == 0)
+            days = true;
+        else {
+            fprintf(stderr, "export: unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    Category categories[max_categories];
+    int category_count = 0;
+    IntervalStore store = {0};
+    cli_load(&store, categories, &category_count, 0);
+    validate_intervals(&store);
+
+    ExportWriter *w = writer_open(STDOUT_FILENO, format);
+    if(days) {
+        for(int i = 0; i < store.count; i++)
+            rollup_add(&store.rollup, &store.items[i], 1);
+        export_days(w, &store.rollup, categories, category_count);
+    } else
+        export_sessions(w, &store, categories, category_count);
+    bool failed = !writer_close(w);
+    store_free(&store);
+    if(failed) {
+        perror("export");
+        return 1;
+    }
+    return 0;
+}
+
+static int cli_start(int argc, char **argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "start: which category?\n");
+        return 2;
+    }
+    // Names may contain spaces, so the rest of the line is the name
+    char name[name_max_length] = {0};
+    for(int i = 1; i < argc; i++) {
+        size_t used = strlen(name);
+        snprintf(name + used, sizeof(name) - used, "%s%s", i > 1 ? " " : "", argv[i]);
+    }
+
+    Category categories[max_categories];
+    int category_count = 0;
+    IntervalStore store = {0};
+    cli_load(&store, categories, &category_count, today_start());
+
+    int category_idx = -1;
+    for(int c = 0; c < category_count && category_idx < 0; c++)
+        if(strcmp(categories[c].name, name) == 0)
+            category_idx = c;
+    for(int c = 0; c < category_count && category_idx < 0; c++)
+        if(strcasecmp(categories[c].name, name) == 0)
+            category_idx = c;
+    if(category_idx < 0) {
+        fprintf(stderr, "start: no category named \"%s\"\n", name);
+        store_free(&store);
+        return 1;
+    }
+
+    Interval *running = open_session(&store);
+    if(running) {
+        fprintf(stderr, "start: a session is already running since ");
+        struct tm t;
+        local_civil(running->start, &t);
+        fprintf(stderr, "%02d:%02d\n", t.tm_hour, t.tm_min);
+        store_free(&store);
+        return 1;
+    }
+
+    Interval session = { .category_idx = categories[category_idx].id, .start = time(NULL) };
+    journal_append(journal_start, &session);
+    printf("Started %s at ", categories[category_idx].name);
+    print_clock(session.start);
+    printf("\n");
+    store_free(&store);
+    return 0;
+}
+
+static int cli_stop(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    Category categories[max_categories];
+    int category_count = 0;
+    IntervalStore store = {0};
+    cli_load(&store, categories, &category_count, today_start());
+
+    Interval *running = open_session(&store);
+    if(!running) {
+        fprintf(stderr, "stop: no session is running\n");
+        store_free(&store);
+        return 1;
+    }
+
+    running->end = time(NULL);
+    if(running->end - running->start > max_time * seconds_in_minute)
+        running->end = running->start + max_time * seconds_in_minute;
+    int focused = running->end - running->start;
+    const char *category = category_label(categories, category_count, running->category_idx);
+    if(focused < min_time) {
+        running->end = 0; // Discards match the still open record
+        journal_append(journal_discard, running);
+        printf("Gave up %s after %dm%ds, shorter than %d minutes\n", category,
+                focused / seconds_in_minute, focused % seconds_in_minute,
+                min_time / seconds_in_minute);
+    } else {
+        journal_append(journal_end, running);
+        printf("Stopped %s after %dm%ds\n", category,
+                focused / seconds_in_minute, focused % seconds_in_minute);
+    }
+    store_free(&store);
+    return 0;
+}
+
+typedef int (*command)(int argc, char **argv);
+
+static const struct {
+    const char *name;
+    const char *usage;
+    command run;
+} commands[] = {
+    { "today", "today", cli_today },
+    { "stats", "stats [--day|--week|--month|--year]", cli_stats },
+    { "export", "export [--csv|--json|--ndjson] [--days]", cli_export },
+    { "start", "start <category>", cli_start },
+    { "stop", "stop", cli_stop },
+};
+
+static int run_command(int argc, char **argv)
+{
+    for(size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+        if(strcmp(argv[0], commands[i].name) == 0)
+            return commands[i].run(argc, argv);
+
+    fprintf(stderr, "usage: tm_tracker [command]\n"
+            "Without a command the interactive tracker starts.\n\ncommands:\n");
+    for(size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+        fprintf(stderr, "  %s\n", commands[i].usage);
+    return 2;
+}
+
+// Core errors are fatal; leave curses first so the message stays readable
+static void restore_terminal(void)
+{
+    endwin();
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1)
+        return run_command(argc - 1, argv + 1);
+
+    set_fatal_handler(restore_terminal);
     initscr();
     cbreak();
     noecho();
@@ -1614,17 +2003,30 @@ int main() {
     Category categories[max_categories]; 
     int category_count = 0;
 
-    Interval intervals[max_intervals];
-    int interval_count = 0;
-
-    pull(categories, sizeof(Category), &category_count, CATEGORIES_FILE);
-    pull(intervals, sizeof(Interval), &interval_count, INTERVALS_FILE);
-    validate_intervals(intervals, &interval_count, category_count);
-    if(!file_exists(FOREST_IMPORTED)) {
-        parse_forest_data(intervals, categories, &interval_count, &category_count);
-        create_file(FOREST_IMPORTED);
+    IntervalStore store = {0};
+
+    pull_categories(categories, &category_count);
+
+    // Today's sessions are enough for the first frame; the rest of the
+    // history loads in the background until a screen needs it
+    struct tm t;
+    local_civil(time(NULL), &t);
+    IntervalStore recent = {0};
+    pull_recent_intervals(&recent, day_start(tm_day_number(&t)));
+    replay_journal(&recent);
+    validate_intervals(&recent);
+    rollup_map_categories(&recent.rollup, categories, category_count);
+    store_build_indexes(&recent);
+    int recent_categories = category_count;
+    StoreLoader *loader = loader_start(&store, categories, &category_count);
+
+    // A session left running, from the command line or before a crash,
+    // goes straight back to the timer
+    if(open_session(&recent)) {
+        finish_loading(&loader, &recent);
+        active_screen(&store, categories, category_count);
     }
-    main_screen(intervals, &interval_count, categories, &category_count);
+    main_screen(&store, &recent, &loader, categories, &category_count, recent_categories);
 
     endwin();
     return 0;
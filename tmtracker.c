@@ -0,0 +1,3635 @@
+#define _DEFAULT_SOURCE
+#include "tmtracker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <strings.h>
+#include <limits.h>
+#include <stdint.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+#define INTERVALS_MAGIC "TMIV"
+#define MANIFEST_MAGIC "TMSM"
+#define ARCHIVE_MAGIC "TMAR"
+#define MANIFEST_FILE "manifest"
+#define SEGMENT_SUFFIX ".dat"
+#define TEMP_SUFFIX ".tmp"
+#define BACKUP_SUFFIX ".bak"
+#define LOCALTIME_FILE "/etc/localtime"
+#define ZONEINFO_DIR "/usr/share/zoneinfo"
+#define TZIF_MAGIC "TZif"
+#define FOREST_FILE ".forest.csv"
+#define FOREST_IMPORTED ".forest_imported"
+#define IMPORTED_SUFFIX ".imported"
+
+enum {
+    import_max_threads = 16,
+    import_chunk_min = 4 << 20, // Bytes each import thread gets at least
+    export_buffer_size = 1 << 20,
+    intervals_version = 2,
+    manifest_version = 1,
+    archive_version = 1,
+    varint_max_length = 10, // 64 bits at 7 per byte
+    magic_length = 4,
+    encode_batch = 4096, // records converted per write when layouts differ
+    rollup_initial_days = 64,
+    tombstone_ratio = 4, // Compact once more than 1 in this many are deleted
+    tzif_header_size = 44,
+    tzif_max_types = 256,
+    tz_rule_max = 64, // Longest footer TZ string that is parsed
+    tz_default_change = 2 * 3600 // POSIX rules switch at 02:00 unless told
+};
+
+static void (*fatal_handler)(void);
+
+void set_fatal_handler(void (*handler)(void))
+{
+    fatal_handler = handler;
+}
+
+static void fatal(const char *msg)
+{
+    int saved = errno;
+    if(fatal_handler)
+        fatal_handler();
+    errno = saved;
+    perror(msg);
+    exit(1);
+}
+
+// On-disk record of INTERVALS_FILE, fixed width regardless of the ABI
+typedef struct DiskInterval {
+    int32_t category_idx;
+    int32_t flags;
+    int64_t start;
+    int64_t end;
+} DiskInterval;
+
+// Self-describing header in front of the DiskInterval records
+typedef struct IntervalsHeader {
+    char magic[magic_length];  // INTERVALS_MAGIC
+    uint32_t version;          // intervals_version
+    uint32_t record_size;      // sizeof(DiskInterval)
+    uint32_t checksum;         // CRC32C of all records
+    uint64_t count;
+} IntervalsHeader;
+
+// MANIFEST_FILE lists every month segment in SEGMENTS_DIR, oldest first
+typedef struct ManifestHeader {
+    char magic[magic_length];  // MANIFEST_MAGIC
+    uint32_t version;          // manifest_version
+    uint32_t count;            // SegmentEntry records that follow
+    uint32_t checksum;         // CRC32C of the entries
+} ManifestHeader;
+
+// format was the high half of a 64-bit count in the first manifests,
+// which therefore read back as segment_raw
+typedef struct SegmentEntry {
+    int32_t month;             // year * months_in_year + month - 1, UTC
+    uint32_t checksum;         // CRC32C of the month's DiskInterval records
+    uint32_t count;
+    uint32_t format;           // SegmentFormat
+} SegmentEntry;
+
+typedef enum SegmentFormat {
+    segment_raw,    // IntervalsHeader and DiskInterval records
+    segment_archive // ArchiveHeader and columns, for closed months
+} SegmentFormat;
+
+// Columns of an archived month, in this order after the header: starts
+// as zigzag varints of their delta-of-delta, durations as varints,
+// categories packed at category_bits each, then flags as varints, only
+// if any item has one
+typedef struct ArchiveHeader {
+    char magic[magic_length];  // ARCHIVE_MAGIC
+    uint32_t version;          // archive_version
+    uint32_t count;
+    uint32_t checksum;         // CRC32C of the DiskInterval records it decodes to
+    uint32_t columns_checksum; // CRC32C of the columns as stored
+    uint32_t starts_size;      // Bytes per column
+    uint32_t durations_size;
+    uint32_t categories_size;
+    uint32_t flags_size;
+    uint32_t category_bits;
+} ArchiveHeader;
+
+// When Interval already matches DiskInterval the file is used in place
+static const bool interval_layout_matches =
+    sizeof(time_t) == sizeof(int64_t)
+    && sizeof(Interval) == sizeof(DiskInterval)
+    && offsetof(Interval, start) == offsetof(DiskInterval, start)
+    && offsetof(Interval, end) == offsetof(DiskInterval, end);
+
+// Columns an importer reads; time columns are only set for formats that
+// keep the date and time of day apart
+typedef enum ImportColumn {
+    column_start,
+    column_start_time,
+    column_end,
+    column_end_time,
+    column_category,
+    import_columns
+} ImportColumn;
+
+// Fixed-size record appended to JOURNAL_FILE for every session event
+typedef struct JournalRecord {
+    int op;
+    int category_idx;
+    time_t start;
+    time_t end;
+} JournalRecord;
+
+// Days since 1970-01-01 of a proleptic Gregorian date, month is 1-12
+int days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+void civil_from_days(int days, int *year, int *month, int *day)
+{
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    int day_of_era = days - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524
+            - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int month_index = (5 * day_of_year + 2) / 153;
+    *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    *month = month_index < 10 ? month_index + 3 : month_index - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+int tm_day_number(const struct tm *t)
+{
+    return days_from_civil(t->tm_year + 1900, t->tm_mon + 1, t->tm_mday);
+}
+
+static int floor_div(int64_t value, int divisor)
+{
+    return (int)(value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor));
+}
+
+// One end of a POSIX TZ daylight saving rule
+typedef struct TzChange {
+    char kind;   // 'J' day 1-365 without Feb 29, 'D' day 0-365, 'M' month.week.day
+    int month;
+    int week;    // 5 is the last such weekday of the month
+    int day;     // Day of year, or weekday with 0 for Sunday
+    int32_t time; // Local seconds after midnight, may be negative
+} TzChange;
+
+// UTC offsets of the local zone, read once from its TZif file
+typedef struct TimeZone {
+    int64_t *transitions; // Sorted instants where the offset changes
+    int32_t *offsets;     // Offset in effect from transitions[i] on
+    int count;
+    int32_t initial_offset;
+    int64_t valid_until; // Past this instant the footer rule applies
+    bool has_rule;       // Otherwise libc has to be asked past valid_until
+    int32_t std_offset;
+    int32_t dst_offset;
+    TzChange dst_start;
+    TzChange dst_end;
+    bool loaded;
+} TimeZone;
+
+static bool tz_rule_number(const char **p, int min, int max, int *value)
+{
+    if(**p < '0' || **p > '9')
+        return false;
+    int n = 0;
+    while(**p >= '0' && **p <= '9' && n <= max)
+        n = n * 10 + *(*p)++ - '0';
+    if(n < min || n > max)
+        return false;
+    *value = n;
+    return true;
+}
+
+// Zone abbreviation, alphabetic or quoted in <>
+static bool tz_rule_name(const char **p)
+{
+    const char *start = *p;
+    if(**p == '<') {
+        while(**p && **p != '>')
+            (*p)++;
+        if(**p != '>')
+            return false;
+        (*p)++;
+        return *p - start >= 5;
+    }
+    while((**p >= 'A' && **p <= 'Z') || (**p >= 'a' && **p <= 'z'))
+        (*p)++;
+    return *p - start >= 3;
+}
+
+// [+-]hh[:mm[:ss]], hours up to 167 as RFC 8536 allows
+static bool tz_rule_time(const char **p, int32_t *seconds)
+{
+    int sign = 1;
+    if(**p == '+' || **p == '-')
+        sign = *(*p)++ == '-' ? -1 : 1;
+    int hours, minutes = 0, secs = 0;
+    if(!tz_rule_number(p, 0, 167, &hours))
+        return false;
+    if(**p == ':') {
+        (*p)++;
+        if(!tz_rule_number(p, 0, 59, &minutes))
+            return false;
+        if(**p == ':') {
+            (*p)++;
+            if(!tz_rule_number(p, 0, 59, &secs))
+                return false;
+        }
+    }
+    *seconds = sign * (hours * seconds_in_hour + minutes * seconds_in_minute + secs);
+    return true;
+}
+
+static bool tz_rule_change(const char **p, TzChange *change)
+{
+    if(*(*p)++ != ',')
+        return false;
+    bool ok;
+    if(**p == 'M') {
+        (*p)++;
+        change->kind = 'M';
+        ok = tz_rule_number(p, 1, months_in_year, &change->month)
+            && *(*p)++ == '.' && tz_rule_number(p, 1, 5, &change->week)
+            && *(*p)++ == '.' && tz_rule_number(p, 0, days_in_week - 1, &change->day);
+    } else if(**p == 'J') {
+        (*p)++;
+        change->kind = 'J';
+        ok = tz_rule_number(p, 1, 365, &change->day);
+    } else {
+        change->kind = 'D';
+        ok = tz_rule_number(p, 0, 365, &change->day);
+    }
+    change->time = tz_default_change;
+    if(ok && **p == '/') {
+        (*p)++;
+        ok = tz_rule_time(p, &change->time);
+    }
+    return ok;
+}
+
+// Footer such as "CET-1CEST,M3.5.0,M10.5.0/3"; POSIX offsets are west of UTC
+static bool tz_parse_rule(TimeZone *zone, const char *rule)
+{
+    const char *p = rule;
+    int32_t std, dst;
+    if(!tz_rule_name(&p) || !tz_rule_time(&p, &std) || !tz_rule_name(&p))
+        return false;
+    dst = std - seconds_in_hour;
+    if(*p != ',' && !tz_rule_time(&p, &dst))
+        return false;
+    if(!tz_rule_change(&p, &zone->dst_start) || !tz_rule_change(&p, &zone->dst_end) || *p)
+        return false;
+    zone->std_offset = -std;
+    zone->dst_offset = -dst;
+    return true;
+}
+
+// Absolute day a rule change falls on in the given year
+static int tz_change_day(const TzChange *change, int year)
+{
+    int jan1 = days_from_civil(year, 1, 1);
+    bool leap = days_from_civil(year, 3, 1) - days_from_civil(year, 2, 1) == 29;
+    if(change->kind == 'J')
+        return jan1 + change->day - 1 + (leap && change->day >= 60);
+    if(change->kind == 'D')
+        return jan1 + change->day;
+
+    int first = days_from_civil(year, change->month, 1);
+    int next = change->month == months_in_year ? days_from_civil(year + 1, 1, 1)
+        : days_from_civil(year, change->month + 1, 1);
+    int weekday = ((first % days_in_week) + days_in_week + 4) % days_in_week; // 1970-01-01 was a Thursday
+    int day = first + (change->day - weekday + days_in_week) % days_in_week
+        + (change->week - 1) * days_in_week;
+    while(day >= next)
+        day -= days_in_week;
+    return day;
+}
+
+static int32_t tz_rule_offset(const TimeZone *zone, int64_t timestamp)
+{
+    int year, month, day;
+    civil_from_days(floor_div(timestamp + zone->std_offset, seconds_in_day), &year, &month, &day);
+    // Changes happen at local time: the start on standard time, the end on daylight time
+    int64_t start = (int64_t)tz_change_day(&zone->dst_start, year) * seconds_in_day
+        + zone->dst_start.time - zone->std_offset;
+    int64_t end = (int64_t)tz_change_day(&zone->dst_end, year) * seconds_in_day
+        + zone->dst_end.time - zone->dst_offset;
+    bool dst = start < end ? timestamp >= start && timestamp < end
+        : timestamp >= start || timestamp < end; // Southern hemisphere
+    return dst ? zone->dst_offset : zone->std_offset;
+}
+
+static int64_t tzif_int(const unsigned char *bytes, int size)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < size; i++)
+        value = value << 8 | bytes[i];
+    if(size == 4)
+        return (int32_t)(uint32_t)value;
+    return (int64_t)value;
+}
+
+static bool tz_parse(TimeZone *zone, const unsigned char *data, size_t size)
+{
+    if(size < tzif_header_size || memcmp(data, TZIF_MAGIC, 4) != 0)
+        return false;
+
+    // Version 2+ files repeat the data with 64-bit times after the v1 block
+    int time_size = 4;
+    const unsigned char *header = data;
+    for(int pass = 0; pass < 2; pass++) {
+        int64_t isutcnt = tzif_int(header + 20, 4);
+        int64_t isstdcnt = tzif_int(header + 24, 4);
+        int64_t leapcnt = tzif_int(header + 28, 4);
+        int64_t timecnt = tzif_int(header + 32, 4);
+        int64_t typecnt = tzif_int(header + 36, 4);
+        int64_t charcnt = tzif_int(header + 40, 4);
+        size_t block = timecnt * time_size + timecnt + typecnt * 6 + charcnt
+            + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+        const unsigned char *body = header + tzif_header_size;
+        if(typecnt < 1 || typecnt > tzif_max_types
+                || (size_t)(body - data) + block > size)
+            return false;
+
+        if(pass == 0 && header[4] >= '2') {
+            header = body + block;
+            time_size = 8;
+            if((size_t)(header - data) + tzif_header_size > size)
+                return false;
+            continue;
+        }
+
+        const unsigned char *times = body;
+        const unsigned char *indices = times + timecnt * time_size;
+        const unsigned char *types = indices + timecnt;
+        zone->transitions = malloc((timecnt + 1) * sizeof(int64_t));
+        zone->offsets = malloc((timecnt + 1) * sizeof(int32_t));
+        if(!zone->transitions || !zone->offsets)
+            return false;
+        for(int64_t i = 0; i < timecnt; i++) {
+            if(indices[i] >= typecnt)
+                return false;
+            zone->transitions[i] = tzif_int(times + i * time_size, time_size);
+            zone->offsets[i] = tzif_int(types + indices[i] * 6, 4);
+        }
+        zone->count = timecnt;
+        zone->initial_offset = tzif_int(types, 4);
+
+        // A footer TZ string with DST rules means offsets keep changing
+        // after the last listed transition; only a plain offset lasts forever.
+        // Slim files stop listing transitions once the rule takes over.
+        const unsigned char *footer = body + block;
+        size_t footer_size = size - (footer - data);
+        bool has_rules = time_size == 8 && memchr(footer, ',', footer_size) != NULL;
+        zone->valid_until = has_rules && timecnt > 0
+            ? zone->transitions[timecnt - 1] : INT64_MAX;
+        const unsigned char *footer_end = has_rules && footer_size > 1 && *footer == '\n'
+            ? memchr(footer + 1, '\n', footer_size - 1) : NULL;
+        if(footer_end && footer_end - footer - 1 < tz_rule_max) {
+            char rule[tz_rule_max];
+            memcpy(rule, footer + 1, footer_end - footer - 1);
+            rule[footer_end - footer - 1] = '\0';
+            zone->has_rule = tz_parse_rule(zone, rule);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void tz_load(TimeZone *zone)
+{
+    zone->loaded = true;
+
+    char path[PATH_MAX];
+    const char *tz = getenv("TZ");
+    if(tz == NULL)
+        snprintf(path, sizeof(path), "%s", LOCALTIME_FILE);
+    else {
+        if(*tz == ':')
+            tz++;
+        if(*tz == '/')
+            snprintf(path, sizeof(path), "%s", tz);
+        else
+            snprintf(path, sizeof(path), "%s/%s", ZONEINFO_DIR, *tz ? tz : "UTC");
+    }
+
+    // Anything unreadable (e.g. POSIX rule strings in TZ) stays on libc
+    FILE *source = fopen(path, "rb");
+    if(!source)
+        return;
+    fseek(source, 0, SEEK_END);
+    long size = ftell(source);
+    rewind(source);
+    unsigned char *data = size > 0 ? malloc(size) : NULL;
+    bool ok = data && fread(data, 1, size, source) == (size_t)size
+        && tz_parse(zone, data, size);
+    fclose(source);
+    free(data);
+    if(!ok) {
+        free(zone->transitions);
+        free(zone->offsets);
+        *zone = (TimeZone){ .loaded = true };
+    }
+}
+
+static TimeZone *local_zone(void)
+{
+    static TimeZone zone;
+    if(!zone.loaded)
+        tz_load(&zone);
+    return zone.offsets ? &zone : NULL;
+}
+
+// UTC offset at an instant, false when the zone table cannot answer
+static bool tz_offset(time_t timestamp, int32_t *offset)
+{
+    TimeZone *zone = local_zone();
+    if(!zone)
+        return false;
+    if(timestamp >= zone->valid_until) {
+        if(!zone->has_rule)
+            return false;
+        *offset = tz_rule_offset(zone, timestamp);
+        return true;
+    }
+
+    // Last transition at or before timestamp
+    int low = 0, high = zone->count;
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(zone->transitions[mid] <= timestamp)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *offset = low == 0 ? zone->initial_offset : zone->offsets[low - 1];
+    return true;
+}
+
+// localtime_r() without the libc lock, falls back to it when needed
+void local_civil(time_t timestamp, struct tm *t)
+{
+    int32_t offset;
+    if(!tz_offset(timestamp, &offset)) {
+        localtime_r(&timestamp, t);
+        return;
+    }
+
+    int64_t local = (int64_t)timestamp + offset;
+    int days = floor_div(local, seconds_in_day);
+    int seconds = (int)(local - (int64_t)days * seconds_in_day);
+    int year, month, day;
+    civil_from_days(days, &year, &month, &day);
+
+    memset(t, 0, sizeof(*t));
+    t->tm_year = year - 1900;
+    t->tm_mon = month - 1;
+    t->tm_mday = day;
+    t->tm_hour = seconds / seconds_in_hour;
+    t->tm_min = seconds % seconds_in_hour / seconds_in_minute;
+    t->tm_sec = seconds % seconds_in_minute;
+    t->tm_wday = ((days % days_in_week) + days_in_week + 4) % days_in_week; // 1970-01-01 was a Thursday
+    t->tm_yday = days - days_from_civil(year, 1, 1);
+    t->tm_isdst = -1;
+    t->tm_gmtoff = offset;
+}
+
+// mktime() replacement: normalizes out-of-range fields and returns the
+// instant, resolving local times inside DST gaps like mktime does.
+time_t local_mktime(struct tm *t)
+{
+    if(!local_zone())
+        return mktime(t);
+
+    int64_t month = (int64_t)t->tm_year * months_in_year + t->tm_mon;
+    int year = floor_div(month, months_in_year) + 1900;
+    int month_of_year = (int)(month - (int64_t)(year - 1900) * months_in_year) + 1;
+    int64_t local = ((int64_t)days_from_civil(year, month_of_year, 1) + t->tm_mday - 1)
+        * seconds_in_day
+        + (int64_t)t->tm_hour * seconds_in_hour
+        + (int64_t)t->tm_min * seconds_in_minute
+        + t->tm_sec;
+
+    // Offsets a day either side cover any transition near this time.
+    // Ambiguous times take the earlier instant; times inside a gap use
+    // the offset from before it, as glibc's mktime does.
+    int32_t before, after, check;
+    if(!tz_offset((time_t)(local - seconds_in_day), &before)
+            || !tz_offset((time_t)(local + seconds_in_day), &after))
+        return mktime(t);
+    time_t result = (time_t)(local - before);
+    if(tz_offset(result, &check) && check != before) {
+        time_t later = (time_t)(local - after);
+        if(tz_offset(later, &check) && check == after)
+            result = later;
+    }
+
+    local_civil(result, t);
+    return result;
+}
+
+static int local_day(time_t timestamp)
+{
+    int32_t offset;
+    if(tz_offset(timestamp, &offset))
+        return floor_div((int64_t)timestamp + offset, seconds_in_day);
+
+    struct tm t;
+    localtime_r(&timestamp, &t);
+    return tm_day_number(&t);
+}
+
+// Instant of local midnight starting an absolute day
+time_t day_start(int day)
+{
+    struct tm t = { .tm_isdst = -1 };
+    int year, month, mday;
+    civil_from_days(day, &year, &month, &mday);
+    t.tm_year = year - 1900;
+    t.tm_mon = month - 1;
+    t.tm_mday = mday;
+    return local_mktime(&t);
+}
+
+// Grows the covered day range geometrically towards the requested day
+static void rollup_cover(DayRollup *rollup, int day)
+{
+    int first = rollup->first_day;
+    int count = rollup->day_count;
+    if(count > 0 && day >= first && day < first + count)
+        return;
+
+    int new_first, new_count;
+    if(count == 0) {
+        new_first = day;
+        new_count = rollup_initial_days;
+    }
+    else if(day < first) {
+        new_first = day - count;
+        new_count = first + count - new_first;
+    }
+    else {
+        new_first = first;
+        new_count = day - first + 1 + count;
+    }
+
+    DayTotals *days = calloc(new_count, sizeof(DayTotals));
+    DayTotals *tree = malloc((size_t)new_count * sizeof(DayTotals));
+    if(!days || !tree) {
+        fatal("CRITICAL: Cannot grow day rollup");
+    }
+    if(count > 0)
+        memcpy(&days[first - new_first], rollup->days, (size_t)count * sizeof(DayTotals));
+    free(rollup->days);
+    free(rollup->tree);
+    rollup->days = days;
+    rollup->tree = tree;
+    rollup->first_day = new_first;
+    rollup->day_count = new_count;
+
+    // Rebuild the Fenwick trees bottom-up in O(days)
+    memcpy(tree, days, (size_t)new_count * sizeof(DayTotals));
+    for(int i = 1; i <= new_count; i++) {
+        int parent = i + (i & -i);
+        if(parent > new_count)
+            continue;
+        for(int c = 0; c < category_slots; c++)
+            tree[parent - 1][c] += tree[i - 1][c];
+    }
+}
+
+// Sum of days [first_day, day] for one category
+static int rollup_prefix(DayRollup *rollup, int slot, int day)
+{
+    int i = day - rollup->first_day + 1;
+    if(i > rollup->day_count)
+        i = rollup->day_count;
+
+    int total = 0;
+    for(; i > 0; i -= i & -i)
+        total += rollup->tree[i - 1][slot];
+    return total;
+}
+
+// Points every category id at its slot, and ids no category has at
+// deleted_category. Adding a category only fills an unused slot, so
+// calling this again afterwards keeps the totals valid.
+void rollup_map_categories(DayRollup *rollup, const Category *categories, int category_count)
+{
+    memset(rollup->slots, deleted_category, sizeof(rollup->slots));
+    for(int i = 0; i < category_count; i++)
+        if(categories[i].id >= 0 && categories[i].id < max_category_ids)
+            rollup->slots[categories[i].id] = i;
+    rollup->mapped = true;
+}
+
+int category_slot(const DayRollup *rollup, int id)
+{
+    if(id < 0 || id >= max_category_ids)
+        return deleted_category;
+    if(!rollup->mapped) // Ids were positions before categories had their own
+        return id < max_categories ? id : deleted_category;
+    return rollup->slots[id];
+}
+
+// sign is 1 when a finished session is added and -1 when it is removed
+void rollup_add(DayRollup *rollup, const Interval *interval, int sign)
+{
+    if(interval->end == 0 || interval->category_idx < 0
+            || interval->category_idx >= max_category_ids)
+        return;
+
+    int day = local_day(interval->start);
+    rollup_cover(rollup, day);
+
+    int slot = category_slot(rollup, interval->category_idx);
+    int seconds = sign * (int)(interval->end - interval->start);
+    rollup->days[day - rollup->first_day][slot] += seconds;
+    for(int i = day - rollup->first_day + 1; i <= rollup->day_count; i += i & -i)
+        rollup->tree[i - 1][slot] += seconds;
+}
+
+// Moves slot idx's seconds to deleted_category and the slots after it
+// down by one, as the categories array does
+static void rollup_fold(DayTotals totals, int idx, int category_count)
+{
+    totals[deleted_category] += totals[idx];
+    for(int c = idx; c < category_count - 1; c++)
+        totals[c] = totals[c + 1];
+    totals[category_count - 1] = 0;
+}
+
+// Sessions keep their category id, which from now on maps to
+// deleted_category. Only the rollup's days are touched, never the
+// history, so this costs the same however many sessions there are.
+void delete_category(DayRollup *rollup, Category *categories, int *category_count, int idx)
+{
+    if(!rollup->mapped)
+        rollup_map_categories(rollup, categories, *category_count);
+    for(int d = 0; d < rollup->day_count; d++) {
+        rollup_fold(rollup->days[d], idx, *category_count);
+        rollup_fold(rollup->tree[d], idx, *category_count);
+    }
+    for(int i = idx; i < (*category_count) - 1; i++)
+        categories[i] = categories[i+1];
+    (*category_count)--;
+    rollup_map_categories(rollup, categories, *category_count);
+}
+
+// The lowest id no category or session has, so a new category never
+// inherits the history of a deleted one. -1 once ids run out.
+int next_category_id(const IntervalStore *store, const Category *categories, int category_count)
+{
+    bool used[max_category_ids] = {0};
+    for(int i = 0; i < category_count; i++)
+        if(categories[i].id >= 0 && categories[i].id < max_category_ids)
+            used[categories[i].id] = true;
+    for(int i = 0; i < store->count; i++)
+        if(store->items[i].category_idx >= 0 && store->items[i].category_idx < max_category_ids)
+            used[store->items[i].category_idx] = true;
+    for(int id = 0; id < max_category_ids; id++)
+        if(!used[id])
+            return id;
+    return -1;
+}
+
+const char *category_label(const Category *categories, int category_count, int id)
+{
+    for(int i = 0; i < category_count; i++)
+        if(categories[i].id == id)
+            return categories[i].name;
+    return DELETED_CATEGORY;
+}
+
+int rollup_category_total(DayRollup *rollup,
+        int slot,
+        int first_day, int last_day)
+{
+    if(first_day > last_day || rollup->day_count == 0)
+        return 0;
+    return rollup_prefix(rollup, slot, last_day)
+        - rollup_prefix(rollup, slot, first_day - 1);
+}
+
+int get_period_total(DayRollup *rollup,
+        int category_count,
+        int first_day, int last_day)
+{
+    int total = rollup_category_total(rollup, deleted_category, first_day, last_day);
+    for(int i = 0; i < category_count; i++)
+        total += rollup_category_total(rollup, i, first_day, last_day);
+    return total;
+}
+
+// Doubles capacity until it holds needed, in size_t so it cannot
+// overflow, stopping at INT_MAX since counts are ints
+static int grown_capacity(int capacity, int needed, size_t item_size, const char *msg)
+{
+    size_t grown = capacity > 0 ? (size_t)capacity : initial_capacity;
+    while(grown < (size_t)needed && grown < INT_MAX)
+        grown *= 2;
+    if(grown > INT_MAX)
+        grown = INT_MAX;
+    if(needed < 0 || grown < (size_t)needed || grown > SIZE_MAX / item_size) {
+        fatal(msg);
+    }
+    return (int)grown;
+}
+
+static void store_reserve(IntervalStore *store, int needed)
+{
+    if(needed <= store->capacity)
+        return;
+
+    int capacity = grown_capacity(store->capacity, needed, sizeof(Interval),
+            "CRITICAL: Cannot grow interval storage");
+
+    Interval *items;
+    if(store->mapping) {
+        items = malloc((size_t)capacity * sizeof(Interval));
+        if(items) {
+            memcpy(items, store->items, (size_t)store->count * sizeof(Interval));
+            munmap(store->mapping, store->mapping_length);
+            store->mapping = NULL;
+        }
+    }
+    else
+        items = realloc(store->items, (size_t)capacity * sizeof(Interval));
+    if(!items) {
+        fatal("CRITICAL: Cannot grow interval storage");
+    }
+    store->items = items;
+    store->capacity = capacity;
+}
+
+Interval *store_append(IntervalStore *store)
+{
+    store_reserve(store, store->count + 1);
+    Interval *interval = &store->items[store->count++];
+    memset(interval, 0, sizeof(Interval));
+    return interval;
+}
+
+bool is_deleted(const Interval *interval)
+{
+    return interval->flags & interval_deleted;
+}
+
+// First index whose start is not before the given instant
+int store_lower_bound(IntervalStore *store, time_t start)
+{
+    int low = 0, high = store->count;
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(store->items[mid].start < start)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Inserts keeping items ordered by start; new sessions hit the fast path
+static Interval *store_insert(IntervalStore *store, time_t start)
+{
+    if(store->count == 0 || store->items[store->count - 1].start <= start) {
+        Interval *interval = store_append(store);
+        interval->start = start;
+        return interval;
+    }
+
+    int idx = store_lower_bound(store, start);
+    store_reserve(store, store->count + 1);
+    memmove(&store->items[idx + 1], &store->items[idx],
+            (size_t)(store->count - idx) * sizeof(Interval));
+    store->count++;
+
+    Interval *interval = &store->items[idx];
+    memset(interval, 0, sizeof(Interval));
+    interval->start = start;
+    return interval;
+}
+
+static int compare_date(const void *a, const void *b)
+{
+    const Interval *interval_a = (const Interval *)a;
+    const Interval *interval_b = (const Interval *)b;
+
+    if(interval_a->start < interval_b->start)
+        return -1;
+    else if(interval_a->start > interval_b->start)
+        return 1;
+    else
+        return 0;
+}
+
+// Files written before the start order was kept may be in any order
+void store_sort(IntervalStore *store)
+{
+    for(int i = 1; i < store->count; i++) {
+        if(store->items[i - 1].start > store->items[i].start) {
+            qsort(store->items, store->count, sizeof(Interval), compare_date);
+            return;
+        }
+    }
+}
+
+// Sessions starting in [from, to)
+int store_count_between(IntervalStore *store, time_t from, time_t to)
+{
+    int first = store_lower_bound(store, from);
+    int last = store_lower_bound(store, to);
+    int count = last - first;
+    if(store->deleted > 0)
+        for(int i = first; i < last; i++)
+            count -= is_deleted(&store->items[i]);
+    return count;
+}
+
+typedef int (*compare_intervals)(const Interval*, const Interval*);
+
+static int compare_start(const Interval *a, const Interval *b)
+{
+    return (a->start > b->start) - (a->start < b->start);
+}
+
+static int compare_duration(const Interval *a, const Interval *b)
+{
+    time_t duration_a = a->end - a->start;
+    time_t duration_b = b->end - b->start;
+    return (duration_a > duration_b) - (duration_a < duration_b);
+}
+
+static int compare_category(const Interval *a, const Interval *b)
+{
+    return (a->category_idx > b->category_idx) - (a->category_idx < b->category_idx);
+}
+
+static const compare_intervals order_compare[sort_orders] = {
+    [sort_date] = compare_start,
+    [sort_duration] = compare_duration,
+    [sort_category] = compare_category
+};
+
+// Stable merge sort of store positions, ties stay in position order
+static void sort_positions(const Interval *intervals, int *order, int count,
+        compare_intervals compare)
+{
+    int *buffer = malloc((size_t)count * sizeof(int));
+    if(!buffer && count > 0) {
+        fatal("CRITICAL: Cannot sort history");
+    }
+    for(int width = 1; width < count; width *= 2) {
+        for(int low = 0; low < count; low += 2 * width) {
+            int mid = low + width < count ? low + width : count;
+            int high = low + 2 * width < count ? low + 2 * width : count;
+            int a = low, b = mid, k = low;
+            while(a < mid && b < high)
+                buffer[k++] = compare(&intervals[order[b]], &intervals[order[a]]) < 0
+                    ? order[b++] : order[a++];
+            while(a < mid)
+                buffer[k++] = order[a++];
+            while(b < high)
+                buffer[k++] = order[b++];
+        }
+        memcpy(order, buffer, (size_t)count * sizeof(int));
+    }
+    free(buffer);
+}
+
+static void store_reserve_orders(IntervalStore *store, int needed)
+{
+    if(needed <= store->orders_capacity)
+        return;
+
+    int capacity = grown_capacity(store->orders_capacity, needed, sizeof(int),
+            "CRITICAL: Cannot grow history order");
+    for(int o = 0; o < sort_orders; o++) {
+        int *order = realloc(store->orders[o], (size_t)capacity * sizeof(int));
+        if(!order) {
+            fatal("CRITICAL: Cannot grow history order");
+        }
+        store->orders[o] = order;
+    }
+    store->orders_capacity = capacity;
+}
+
+void store_build_orders(IntervalStore *store)
+{
+    store_reserve_orders(store, store->count);
+    int live = 0;
+    for(int i = 0; i < store->count; i++)
+        if(!is_deleted(&store->items[i]) && store->items[i].end != 0)
+            store->orders[sort_date][live++] = i;
+    for(int o = 0; o < sort_orders; o++) {
+        if(o != sort_date) {
+            memcpy(store->orders[o], store->orders[sort_date], (size_t)live * sizeof(int));
+            sort_positions(store->items, store->orders[o], live, order_compare[o]);
+        }
+    }
+    store->orders_count = live;
+}
+
+// Store position of the rank-th live session in the given order
+int store_ordered(IntervalStore *store, SortOrder sort, int rank)
+{
+    return store->orders[sort][rank];
+}
+
+// Orders are sorted by (key, position), so a position has exactly one rank
+static int order_rank(IntervalStore *store, SortOrder sort, int position)
+{
+    int *order = store->orders[sort];
+    const Interval *target = &store->items[position];
+    int low = 0, high = store->orders_count;
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        int cmp = order_compare[sort](&store->items[order[mid]], target);
+        if(cmp < 0 || (cmp == 0 && order[mid] < position))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static void store_order_position(IntervalStore *store, int position)
+{
+    store_reserve_orders(store, store->orders_count + 1);
+    for(int o = 0; o < sort_orders; o++) {
+        int *order = store->orders[o];
+        int rank = order_rank(store, o, position);
+        memmove(&order[rank + 1], &order[rank],
+                (size_t)(store->orders_count - rank) * sizeof(int));
+        order[rank] = position;
+    }
+    store->orders_count++;
+}
+
+static void store_unorder(IntervalStore *store, int position)
+{
+    for(int o = 0; o < sort_orders; o++) {
+        int *order = store->orders[o];
+        int rank = order_rank(store, o, position);
+        memmove(&order[rank], &order[rank + 1],
+                (size_t)(store->orders_count - rank - 1) * sizeof(int));
+    }
+    store->orders_count--;
+}
+
+void store_build_indexes(IntervalStore *store)
+{
+    for(int i = 0; i < store->count; i++)
+        if(!is_deleted(&store->items[i]))
+            rollup_add(&store->rollup, &store->items[i], 1);
+    store_build_orders(store);
+    store->indexed = true;
+}
+
+// Called once a running session got its final end time
+void store_close_interval(IntervalStore *store, Interval *interval)
+{
+    if(!store->indexed)
+        return;
+    rollup_add(&store->rollup, interval, 1);
+    store_order_position(store, interval - store->items);
+}
+
+// Live sessions, i.e. not counting tombstones
+int store_live_count(IntervalStore *store)
+{
+    return store->count - store->deleted;
+}
+
+// Drops tombstoned items, invalidating every position handed out before
+void store_compact(IntervalStore *store)
+{
+    if(store->deleted == 0)
+        return;
+
+    int kept = 0;
+    for(int i = 0; i < store->count; i++) {
+        if(is_deleted(&store->items[i]))
+            continue;
+        if(kept != i)
+            store->items[kept] = store->items[i];
+        kept++;
+    }
+    store->count = kept;
+    store->deleted = 0;
+    if(store->indexed)
+        store_build_orders(store);
+}
+
+bool store_needs_compaction(IntervalStore *store)
+{
+    return store->deleted * tombstone_ratio > store->count;
+}
+
+void store_free(IntervalStore *store)
+{
+    free(store->rollup.days);
+    free(store->rollup.tree);
+    store->rollup = (DayRollup){0};
+    for(int o = 0; o < sort_orders; o++) {
+        free(store->orders[o]);
+        store->orders[o] = NULL;
+    }
+    store->orders_count = store->orders_capacity = 0;
+    store->indexed = false;
+    if(store->mapping)
+        munmap(store->mapping, store->mapping_length);
+    else
+        free(store->items);
+    store->items = NULL;
+    store->mapping = NULL;
+    store->count = store->capacity = store->deleted = 0;
+}
+
+// O(1) on the items: the slot is tombstoned and reclaimed by store_compact()
+void delete_interval(IntervalStore *store, int idx)
+{
+    Interval *interval = &store->items[idx];
+    if(is_deleted(interval))
+        return;
+    if(store->indexed) {
+        rollup_add(&store->rollup, interval, -1);
+        store_unorder(store, idx);
+    }
+    interval->flags |= interval_deleted;
+    store->deleted++;
+}
+
+void restore_interval(IntervalStore *store, int idx)
+{
+    Interval *interval = &store->items[idx];
+    if(!is_deleted(interval))
+        return;
+    interval->flags &= ~interval_deleted;
+    store->deleted--;
+    if(store->indexed) {
+        rollup_add(&store->rollup, interval, 1);
+        store_order_position(store, idx);
+    }
+}
+
+static void get_data_path(char *dest, char *file_name) {
+    const char *home = getenv("HOME");
+    if(home == NULL)
+        snprintf(dest, PATH_MAX, "%s", file_name);
+    else
+        snprintf(dest, PATH_MAX, "%s/%s", home, file_name);
+}
+static bool file_exists(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if(file) {
+        fclose(file);
+        return true;
+    }
+    return false;
+}
+
+// Table-driven CRC32C (Castagnoli), eight bytes per step
+static uint32_t crc32c_table(uint32_t crc, const void *data, size_t length)
+{
+    static uint32_t table[8][256];
+    static bool table_ready = false;
+    if(!table_ready) {
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for(int bit = 0; bit < 8; bit++)
+                value = (value >> 1) ^ (0x82F63B78u & -(value & 1u));
+            table[0][i] = value;
+        }
+        for(uint32_t i = 0; i < 256; i++)
+            for(int k = 1; k < 8; k++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        table_ready = true;
+    }
+
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    while(length >= 8) {
+        uint32_t low = crc ^ ((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8
+                | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF]
+            ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24]
+            ^ table[3][bytes[4]] ^ table[2][bytes[5]]
+            ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+        bytes += 8;
+        length -= 8;
+    }
+    while(length--)
+        crc = (crc >> 8) ^ table[0][(crc ^ *bytes++) & 0xFF];
+    return ~crc;
+}
+
+#if defined(CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    uint64_t value = ~crc;
+    for(; length >= 8; bytes += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        value = _mm_crc32_u64(value, word);
+    }
+    uint32_t result = (uint32_t)value;
+    while(length--)
+        result = _mm_crc32_u8(result, *bytes++);
+    return ~result;
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32c_hardware(uint32_t crc, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    for(; length >= 8; bytes += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    while(length--)
+        crc = __crc32cb(crc, *bytes++);
+    return ~crc;
+}
+#endif
+
+// Uses the CPU's CRC32C instruction where there is one; both give the
+// same checksums, so files move freely between machines
+static uint32_t crc32c(uint32_t crc, const void *data, size_t length)
+{
+#if defined(CRC32C_SSE42)
+    static int hardware = -1;
+    if(hardware < 0)
+        hardware = __builtin_cpu_supports("sse4.2");
+    if(hardware)
+        return crc32c_hardware(crc, data, length);
+#elif defined(CRC32C_ARM)
+    return crc32c_hardware(crc, data, length);
+#endif
+    return crc32c_table(crc, data, length);
+}
+
+static void create_file(const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if(file)
+        fclose(file);
+}
+
+// Flushes dest all the way to the disk before closing it
+static bool close_synced(FILE *dest)
+{
+    bool ok = fflush(dest) == 0 && fsync(fileno(dest)) == 0;
+    return fclose(dest) == 0 && ok;
+}
+
+// Makes renames and unlinks in the directory holding path durable
+static void sync_directory(const char *path)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if(slash)
+        *slash = '\0';
+    int fd = open(slash ? dir : ".", O_RDONLY | O_DIRECTORY);
+    if(fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// The copy path had before its last save, kept for recovery
+static void backup_path(char *dest, const char *path)
+{
+    snprintf(dest, PATH_MAX + sizeof(BACKUP_SUFFIX), "%s%s", path, BACKUP_SUFFIX);
+}
+
+// Moves temp_path over path in one step. With keep_backup the old file
+// stays reachable as its backup, which is only a second link, so
+// nothing is copied.
+static void replace_file(const char *temp_path, const char *path, bool keep_backup)
+{
+    char backup[PATH_MAX + sizeof(BACKUP_SUFFIX)];
+    backup_path(backup, path);
+    unlink(backup);
+    if(keep_backup)
+        link(path, backup); // Fails harmlessly on the first save
+    if(rename(temp_path, path) != 0) {
+        fatal("CRITICAL: Failde to write data");
+    }
+}
+
+// A count, count records and a CRC32C of both. The file is written
+// aside and renamed over the old one, so a crash leaves either copy
+// intact, never half of each.
+void push(void *attr, size_t size, int count, char *file_name)
+{
+    char path[PATH_MAX], temp_path[PATH_MAX + sizeof(TEMP_SUFFIX)];
+    get_data_path(path, file_name);
+    snprintf(temp_path, sizeof(temp_path), "%s%s", path, TEMP_SUFFIX);
+
+    FILE *dest = fopen(temp_path, "wb");
+    if(!dest) {
+        fatal("CRITICAL: Cannot to save data");
+    }
+
+    uint32_t checksum = crc32c(crc32c(0, &count, sizeof(int)), attr, size * count);
+    size_t transferred_count = fwrite(&count, sizeof(int), 1, dest);
+    size_t transferred_data = fwrite(attr, size, count, dest);
+    size_t transferred_checksum = fwrite(&checksum, sizeof(checksum), 1, dest);
+    if(!close_synced(dest) || transferred_data != count || transferred_count != 1
+            || transferred_checksum != 1) {
+        fatal("CRITICAL: Failde to write data");
+    }
+    replace_file(temp_path, path, true);
+    sync_directory(path);
+}
+
+// Files from before checksums end right after the records and are
+// taken as they are
+static bool pull_file(void *attr, size_t size, int *count, int capacity, const char *path)
+{
+    FILE *source = fopen(path, "rb");
+    if(!source)
+        return false;
+
+    struct stat st;
+    int read_count;
+    uint32_t checksum;
+    bool ok = fstat(fileno(source), &st) == 0
+        && fread(&read_count, sizeof(int), 1, source) == 1
+        && read_count >= 0 && read_count <= capacity
+        && fread(attr, size, read_count, source) == (size_t)read_count;
+    size_t length = sizeof(int) + size * read_count;
+    if(ok && (size_t)st.st_size != length)
+        ok = (size_t)st.st_size == length + sizeof(checksum)
+            && fread(&checksum, sizeof(checksum), 1, source) == 1
+            && checksum == crc32c(crc32c(0, &read_count, sizeof(int)), attr, size * read_count);
+    fclose(source);
+    *count = ok ? read_count : 0;
+    return ok;
+}
+
+// Falls back to the copy before the last save if the file is damaged,
+// and to nothing only if that is damaged too
+void pull(void *attr, size_t size, int *count, int capacity, char *file_name)
+{
+    char path[PATH_MAX], backup[PATH_MAX + sizeof(BACKUP_SUFFIX)];
+    get_data_path(path, file_name);
+    backup_path(backup, path);
+
+    if(!pull_file(attr, size, count, capacity, path))
+        pull_file(attr, size, count, capacity, backup);
+}
+
+// Before ids, a category was its position in the file, and that
+// position is what old sessions store
+static bool pull_legacy_categories(Category *categories, int *category_count, const char *path)
+{
+    char names[max_categories][name_max_length];
+    if(!pull_file(names, sizeof(names[0]), category_count, max_categories, path))
+        return false;
+    for(int i = 0; i < *category_count; i++) {
+        memcpy(categories[i].name, names[i], name_max_length);
+        categories[i].id = i;
+    }
+    return true;
+}
+
+void pull_categories(Category *categories, int *category_count)
+{
+    char path[PATH_MAX], backup[PATH_MAX + sizeof(BACKUP_SUFFIX)];
+    get_data_path(path, CATEGORIES_FILE);
+    backup_path(backup, path);
+
+    if(!pull_file(categories, sizeof(Category), category_count, max_categories, path)
+            && !pull_legacy_categories(categories, category_count, path)
+            && !pull_file(categories, sizeof(Category), category_count, max_categories, backup))
+        pull_legacy_categories(categories, category_count, backup);
+}
+
+static void encode_interval(DiskInterval *dest, const Interval *src)
+{
+    dest->category_idx = src->category_idx;
+    dest->flags = src->flags;
+    dest->start = src->start;
+    dest->end = src->end;
+}
+
+static void decode_interval(Interval *dest, const DiskInterval *src)
+{
+    memset(dest, 0, sizeof(Interval));
+    dest->category_idx = src->category_idx;
+    dest->flags = src->flags;
+    dest->start = (time_t)src->start;
+    dest->end = (time_t)src->end;
+}
+
+// Checksum of count items as they are laid out on disk
+static uint32_t records_checksum(const Interval *items, int count)
+{
+    if(interval_layout_matches)
+        return crc32c(0, items, (size_t)count * sizeof(DiskInterval));
+
+    uint32_t checksum = 0;
+    DiskInterval batch[encode_batch];
+    for(int i = 0; i < count; i += encode_batch) {
+        int n = count - i < encode_batch ? count - i : encode_batch;
+        for(int j = 0; j < n; j++)
+            encode_interval(&batch[j], &items[i + j]);
+        checksum = crc32c(checksum, batch, (size_t)n * sizeof(DiskInterval));
+    }
+    return checksum;
+}
+
+// Writes a temp file and renames it over the old one, so a mapping of
+// the previous file stays valid while it is being replaced. The caller
+// syncs the directory once all segments are in place. A backup is kept
+// for a month that changed, not for one written for the first time.
+static void write_segment(const char *path, const Interval *items, int count, uint32_t checksum,
+        bool keep_backup)
+{
+    char temp_path[PATH_MAX + sizeof(TEMP_SUFFIX)];
+    snprintf(temp_path, sizeof(temp_path), "%s%s", path, TEMP_SUFFIX);
+
+    FILE *dest = fopen(temp_path, "wb");
+    if(!dest) {
+        fatal("CRITICAL: Cannot to save data");
+    }
+
+    IntervalsHeader header = {
+        .magic = INTERVALS_MAGIC,
+        .version = intervals_version,
+        .record_size = sizeof(DiskInterval),
+        .checksum = checksum,
+        .count = count
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, dest) == 1;
+
+    if(interval_layout_matches)
+        ok = ok && fwrite(items, sizeof(DiskInterval), count, dest) == (size_t)count;
+    else {
+        DiskInterval batch[encode_batch];
+        for(int i = 0; ok && i < count; i += encode_batch) {
+            int n = count - i < encode_batch ? count - i : encode_batch;
+            for(int j = 0; j < n; j++)
+                encode_interval(&batch[j], &items[i + j]);
+            ok = fwrite(batch, sizeof(DiskInterval), n, dest) == (size_t)n;
+        }
+    }
+
+    if(!close_synced(dest) || !ok) {
+        fatal("CRITICAL: Failde to write data");
+    }
+    replace_file(temp_path, path, keep_backup);
+}
+
+// Segments split sessions by the UTC month they start in, so the split
+// does not move when the local zone changes
+static int segment_month(time_t start)
+{
+    int year, month, day;
+    civil_from_days(floor_div(start, seconds_in_day), &year, &month, &day);
+    return year * months_in_year + month - 1;
+}
+
+static time_t segment_end(int month)
+{
+    int next = month + 1;
+    return (time_t)days_from_civil(next / months_in_year, next % months_in_year + 1, 1)
+        * seconds_in_day;
+}
+
+static void segment_path(char *dest, int month)
+{
+    char name[field_max_length];
+    snprintf(name, sizeof(name), "%s/%04d-%02d%s", SEGMENTS_DIR,
+            month / months_in_year, month % months_in_year + 1, SEGMENT_SUFFIX);
+    get_data_path(dest, name);
+}
+
+// False if the manifest is missing or damaged; entries are by month
+static bool read_manifest(SegmentEntry **entries, int *entry_count)
+{
+    char name[field_max_length], path[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/%s", SEGMENTS_DIR, MANIFEST_FILE);
+    get_data_path(path, name);
+
+    *entries = NULL;
+    *entry_count = 0;
+    FILE *source = fopen(path, "rb");
+    if(!source)
+        return false;
+
+    ManifestHeader header;
+    bool ok = fread(&header, sizeof(header), 1, source) == 1
+        && memcmp(header.magic, MANIFEST_MAGIC, magic_length) == 0
+        && header.version == manifest_version
+        && header.count <= INT32_MAX / sizeof(SegmentEntry);
+    SegmentEntry *read_entries = ok ? malloc((header.count + 1) * sizeof(SegmentEntry)) : NULL;
+    ok = read_entries
+        && fread(read_entries, sizeof(SegmentEntry), header.count, source) == header.count
+        && crc32c(0, read_entries, header.count * sizeof(SegmentEntry)) == header.checksum;
+    fclose(source);
+    if(!ok) {
+        free(read_entries);
+        return false;
+    }
+    *entries = read_entries;
+    *entry_count = (int)header.count;
+    return true;
+}
+
+static void write_manifest(const SegmentEntry *entries, int entry_count)
+{
+    char name[field_max_length], path[PATH_MAX], temp_path[PATH_MAX + sizeof(TEMP_SUFFIX)];
+    snprintf(name, sizeof(name), "%s/%s", SEGMENTS_DIR, MANIFEST_FILE);
+    get_data_path(path, name);
+    snprintf(temp_path, sizeof(temp_path), "%s%s", path, TEMP_SUFFIX);
+
+    ManifestHeader header = {
+        .magic = MANIFEST_MAGIC,
+        .version = manifest_version,
+        .count = entry_count,
+        .checksum = crc32c(0, entries, (size_t)entry_count * sizeof(SegmentEntry))
+    };
+    FILE *dest = fopen(temp_path, "wb");
+    if(!dest) {
+        fatal("CRITICAL: Cannot to save data");
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, dest) == 1
+        && fwrite(entries, sizeof(SegmentEntry), entry_count, dest) == (size_t)entry_count;
+    if(!close_synced(dest) || !ok || rename(temp_path, path) != 0) {
+        fatal("CRITICAL: Failde to write data");
+    }
+    sync_directory(path);
+}
+
+static unsigned char *put_varint(unsigned char *out, uint64_t value)
+{
+    while(value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+static bool get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for(int shift = 0; shift < 7 * varint_max_length && *p < end; shift += 7) {
+        unsigned char byte = *(*p)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Only finished sessions with a known category fit the columns
+static bool archivable(const Interval *items, int count)
+{
+    for(int i = 0; i < count; i++)
+        if(items[i].end == 0 || items[i].end < items[i].start || items[i].category_idx < 0)
+            return false;
+    return true;
+}
+
+// Encodes items as an archived segment, header included. NULL if they
+// are not archivable.
+unsigned char *archive_encode(const Interval *items, int count, size_t *size)
+{
+    if(!archivable(items, count))
+        return NULL;
+
+    int max_category = 0;
+    bool flagged = false;
+    for(int i = 0; i < count; i++) {
+        if(items[i].category_idx > max_category)
+            max_category = items[i].category_idx;
+        flagged = flagged || items[i].flags != 0;
+    }
+    int bits = 0;
+    while(max_category >> bits)
+        bits++;
+
+    size_t worst = sizeof(ArchiveHeader)
+        + (size_t)count * (3 * varint_max_length + sizeof(uint32_t));
+    unsigned char *data = malloc(worst);
+    if(!data) {
+        fatal("CRITICAL: Cannot allocate archive buffer");
+    }
+
+    ArchiveHeader header = {
+        .magic = ARCHIVE_MAGIC,
+        .version = archive_version,
+        .count = count,
+        .checksum = records_checksum(items, count),
+        .category_bits = bits
+    };
+    unsigned char *out = data + sizeof(header), *column = out;
+
+    uint64_t previous = 0, previous_delta = 0;
+    for(int i = 0; i < count; i++) {
+        // Unsigned wrap-around keeps any int64_t start reversible
+        uint64_t delta = (uint64_t)items[i].start - previous;
+        out = put_varint(out, zigzag((int64_t)(delta - previous_delta)));
+        previous = (uint64_t)items[i].start;
+        previous_delta = delta;
+    }
+    header.starts_size = out - column;
+
+    column = out;
+    for(int i = 0; i < count; i++)
+        out = put_varint(out, (uint64_t)(items[i].end - items[i].start));
+    header.durations_size = out - column;
+
+    column = out;
+    uint64_t pending = 0;
+    int pending_bits = 0;
+    for(int i = 0; i < count; i++) {
+        pending |= (uint64_t)items[i].category_idx << pending_bits;
+        for(pending_bits += bits; pending_bits >= 8; pending_bits -= 8) {
+            *out++ = (unsigned char)pending;
+            pending >>= 8;
+        }
+    }
+    if(pending_bits > 0)
+        *out++ = (unsigned char)pending;
+    header.categories_size = out - column;
+
+    column = out;
+    for(int i = 0; flagged && i < count; i++)
+        out = put_varint(out, (uint32_t)items[i].flags);
+    header.flags_size = out - column;
+
+    header.columns_checksum = crc32c(0, data + sizeof(header), out - data - sizeof(header));
+    memcpy(data, &header, sizeof(header));
+    *size = out - data;
+    return data;
+}
+
+// Decodes an archived segment of count items into dest. False if the
+// columns fail their checksum or do not decode to exactly count items.
+bool archive_decode(const unsigned char *data, size_t size, Interval *dest, int count)
+{
+    ArchiveHeader header;
+    if(size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, ARCHIVE_MAGIC, magic_length) != 0
+            || header.version != archive_version
+            || header.count != (uint32_t)count
+            || header.category_bits > 31
+            || (uint64_t)header.starts_size + header.durations_size
+                + header.categories_size + header.flags_size != size - sizeof(header)
+            || header.categories_size != ((uint64_t)count * header.category_bits + 7) / 8
+            || crc32c(0, data + sizeof(header), size - sizeof(header)) != header.columns_checksum)
+        return false;
+
+    const unsigned char *p = data + sizeof(header), *end = p + header.starts_size;
+    uint64_t previous = 0, previous_delta = 0, value;
+    for(int i = 0; i < count; i++) {
+        if(!get_varint(&p, end, &value))
+            return false;
+        previous_delta += (uint64_t)unzigzag(value);
+        previous += previous_delta;
+        dest[i] = (Interval){ .start = (time_t)(int64_t)previous };
+    }
+
+    if(p != end)
+        return false;
+    end += header.durations_size;
+    for(int i = 0; i < count; i++) {
+        if(!get_varint(&p, end, &value))
+            return false;
+        dest[i].end = (time_t)((uint64_t)dest[i].start + value);
+    }
+
+    if(p != end)
+        return false;
+    end += header.categories_size;
+    uint64_t pending = 0;
+    int pending_bits = 0;
+    uint32_t mask = ((uint32_t)1 << header.category_bits) - 1;
+    for(int i = 0; i < count; i++) {
+        while(pending_bits < (int)header.category_bits) {
+            pending |= (uint64_t)*p++ << pending_bits;
+            pending_bits += 8;
+        }
+        dest[i].category_idx = (int)(pending & mask);
+        pending >>= header.category_bits;
+        pending_bits -= header.category_bits;
+    }
+
+    p = end;
+    end += header.flags_size;
+    for(int i = 0; header.flags_size > 0 && i < count; i++) {
+        if(!get_varint(&p, end, &value))
+            return false;
+        dest[i].flags = (int)(uint32_t)value;
+    }
+    return p == end;
+}
+
+static void write_archive(const char *path, const unsigned char *data, size_t size,
+        bool keep_backup)
+{
+    char temp_path[PATH_MAX + sizeof(TEMP_SUFFIX)];
+    snprintf(temp_path, sizeof(temp_path), "%s%s", path, TEMP_SUFFIX);
+
+    FILE *dest = fopen(temp_path, "wb");
+    if(!dest) {
+        fatal("CRITICAL: Cannot to save data");
+    }
+    bool ok = fwrite(data, 1, size, dest) == size;
+    if(!close_synced(dest) || !ok) {
+        fatal("CRITICAL: Failde to write data");
+    }
+    // The raw segment it replaces, or the archive before an edit, stays
+    // behind as the backup; both formats read back through read_segment
+    replace_file(temp_path, path, keep_backup);
+}
+
+// Appends an archived segment to store; found gets its count and checksum
+static bool read_archive(FILE *source, IntervalStore *store, SegmentEntry *found)
+{
+    struct stat st;
+    if(fstat(fileno(source), &st) != 0 || st.st_size < (off_t)sizeof(ArchiveHeader))
+        return false;
+    size_t size = (size_t)st.st_size;
+    unsigned char *data = malloc(size);
+    ArchiveHeader *header = (ArchiveHeader *)data;
+    // Every session takes at least a byte, which bounds a damaged count
+    bool ok = data && fread(data, 1, size, source) == size
+        && header->count <= size && header->count <= (uint64_t)(INT32_MAX - store->count);
+    if(ok) {
+        store_reserve(store, store->count + (int)header->count);
+        ok = archive_decode(data, size, &store->items[store->count], (int)header->count);
+    }
+    if(ok) {
+        *found = (SegmentEntry){
+            .checksum = header->checksum, .count = header->count, .format = segment_archive
+        };
+        store->count += (int)header->count;
+    }
+    free(data);
+    return ok;
+}
+
+// Appends one segment file to store, raw or archived. Each format
+// carries its own count and checksum, so the file is verified without
+// the manifest; found says what it held.
+static bool read_segment(const char *path, IntervalStore *store, SegmentEntry *found)
+{
+    FILE *source = fopen(path, "rb");
+    if(!source)
+        return false;
+
+    char magic[magic_length];
+    bool ok = fread(magic, magic_length, 1, source) == 1 && fseek(source, 0, SEEK_SET) == 0;
+    if(ok && memcmp(magic, ARCHIVE_MAGIC, magic_length) == 0) {
+        ok = read_archive(source, store, found);
+        fclose(source);
+        return ok;
+    }
+
+    struct stat st;
+    IntervalsHeader header;
+    ok = ok && fstat(fileno(source), &st) == 0
+        && fread(&header, sizeof(header), 1, source) == 1
+        && memcmp(header.magic, INTERVALS_MAGIC, magic_length) == 0
+        && header.version == intervals_version
+        && header.record_size == sizeof(DiskInterval)
+        && header.count <= (uint64_t)(INT32_MAX - store->count)
+        && (uint64_t)st.st_size == sizeof(header) + header.count * sizeof(DiskInterval);
+    if(!ok) {
+        fclose(source);
+        return false;
+    }
+
+    int count = (int)header.count;
+    store_reserve(store, store->count + count);
+    Interval *dest = &store->items[store->count];
+    uint32_t checksum = 0;
+    if(interval_layout_matches) {
+        ok = fread(dest, sizeof(DiskInterval), count, source) == (size_t)count;
+        checksum = crc32c(0, dest, (size_t)count * sizeof(DiskInterval));
+    }
+    else {
+        DiskInterval batch[encode_batch];
+        for(int i = 0; ok && i < count; i += encode_batch) {
+            int n = count - i < encode_batch ? count - i : encode_batch;
+            ok = fread(batch, sizeof(DiskInterval), n, source) == (size_t)n;
+            checksum = crc32c(checksum, batch, (size_t)n * sizeof(DiskInterval));
+            for(int j = 0; ok && j < n; j++)
+                decode_interval(&dest[i + j], &batch[j]);
+        }
+    }
+    fclose(source);
+    if(!ok || checksum != header.checksum)
+        return false;
+    *found = (SegmentEntry){ .checksum = checksum, .count = header.count, .format = segment_raw };
+    store->count += count;
+    return true;
+}
+
+// Appends one month to store. A damaged segment falls back to the copy
+// from before its last save, so the month loses at most that save.
+static bool pull_segment(IntervalStore *store, int month)
+{
+    char path[PATH_MAX], backup[PATH_MAX + sizeof(BACKUP_SUFFIX)];
+    SegmentEntry found;
+    segment_path(path, month);
+    backup_path(backup, path);
+    return read_segment(path, store, &found) || read_segment(backup, store, &found);
+}
+
+static int compare_segments(const void *a, const void *b)
+{
+    int x = ((const SegmentEntry *)a)->month, y = ((const SegmentEntry *)b)->month;
+    return (x > y) - (x < y);
+}
+
+// When the manifest is lost the directory itself says which months
+// exist. Entries come back sorted, counts are left at zero.
+static bool scan_segments(SegmentEntry **entries, int *entry_count)
+{
+    char path[PATH_MAX];
+    get_data_path(path, SEGMENTS_DIR);
+    *entries = NULL;
+    *entry_count = 0;
+    DIR *dir = opendir(path);
+    if(!dir)
+        return false;
+
+    int capacity = 0;
+    struct dirent *file;
+    while((file = readdir(dir))) {
+        int year, month, length = 0;
+        if(sscanf(file->d_name, "%4d-%2d" SEGMENT_SUFFIX "%n", &year, &month, &length) != 2
+                || file->d_name[length] != '\0' || length == 0
+                || month < 1 || month > months_in_year)
+            continue;
+        if(*entry_count == capacity) {
+            capacity = capacity ? capacity * 2 : months_in_year;
+            SegmentEntry *grown = realloc(*entries, capacity * sizeof(SegmentEntry));
+            if(!grown) {
+                fatal("CRITICAL: Cannot allocate segment manifest");
+            }
+            *entries = grown;
+        }
+        (*entries)[(*entry_count)++] = (SegmentEntry){ .month = year * months_in_year + month - 1 };
+    }
+    closedir(dir);
+    if(*entry_count > 0)
+        qsort(*entries, *entry_count, sizeof(SegmentEntry), compare_segments);
+    return *entry_count > 0;
+}
+
+static void remove_segment(int month)
+{
+    char path[PATH_MAX], backup[PATH_MAX + sizeof(BACKUP_SUFFIX)];
+    segment_path(path, month);
+    backup_path(backup, path);
+    unlink(path);
+    unlink(backup);
+}
+
+// Rewrites only the months whose sessions differ from what the manifest
+// recorded, then the manifest. Closed months are normally left alone,
+// so a save costs one segment write plus a checksum pass in memory.
+// A month is archived once it is over, the current one stays raw.
+void push_intervals(IntervalStore *store)
+{
+    SegmentEntry *saved;
+    int saved_count;
+    read_manifest(&saved, &saved_count);
+
+    char path[PATH_MAX];
+    get_data_path(path, SEGMENTS_DIR);
+    if(mkdir(path, 0755) != 0 && errno != EEXIST) {
+        fatal("CRITICAL: Cannot to save data");
+    }
+
+    int capacity = saved_count + 1;
+    SegmentEntry *entries = malloc(capacity * sizeof(SegmentEntry));
+    if(!entries) {
+        fatal("CRITICAL: Cannot allocate segment manifest");
+    }
+    int entry_count = 0, s = 0;
+    int current_month = segment_month(time(NULL));
+    for(int first = 0; first < store->count;) {
+        int month = segment_month(store->items[first].start);
+        int last = store_lower_bound(store, segment_end(month));
+        int count = last - first;
+        uint32_t checksum = records_checksum(&store->items[first], count);
+
+        // Months that lost all their sessions
+        for(; s < saved_count && saved[s].month < month; s++)
+            remove_segment(saved[s].month);
+        segment_path(path, month);
+        SegmentFormat format = month < current_month
+            && archivable(&store->items[first], count) ? segment_archive : segment_raw;
+        struct stat st;
+        bool unchanged = s < saved_count && saved[s].month == month
+            && saved[s].count == (uint32_t)count && saved[s].checksum == checksum
+            && saved[s].format == format
+            && stat(path, &st) == 0
+            && (format == segment_archive
+                || (size_t)st.st_size == sizeof(IntervalsHeader) + count * sizeof(DiskInterval));
+        bool was_saved = s < saved_count && saved[s].month == month;
+        if(was_saved)
+            s++;
+        if(!unchanged && format == segment_archive) {
+            size_t size;
+            unsigned char *data = archive_encode(&store->items[first], count, &size);
+            write_archive(path, data, size, was_saved);
+            free(data);
+        }
+        else if(!unchanged)
+            write_segment(path, &store->items[first], count, checksum, was_saved);
+
+        if(entry_count == capacity) {
+            capacity *= 2;
+            SegmentEntry *grown = realloc(entries, capacity * sizeof(SegmentEntry));
+            if(!grown) {
+                fatal("CRITICAL: Cannot allocate segment manifest");
+            }
+            entries = grown;
+        }
+        entries[entry_count++] = (SegmentEntry){
+            .month = month, .checksum = checksum, .count = count, .format = format
+        };
+        first = last;
+    }
+    for(; s < saved_count; s++)
+        remove_segment(saved[s].month);
+
+    // Segments must be on disk before a manifest that lists them
+    get_data_path(path, SEGMENTS_DIR);
+    sync_directory(path);
+    write_manifest(entries, entry_count);
+    free(entries);
+    free(saved);
+
+    // History kept in a single file before segments is superseded now
+    get_data_path(path, INTERVALS_FILE);
+    unlink(path);
+}
+
+// Pre-v2 files are a raw int count followed by in-memory Interval structs
+static bool pull_legacy_intervals(IntervalStore *store, FILE *source, off_t size)
+{
+    int count = 0;
+    // The count is checked against the file before anything is allocated
+    if(fread(&count, sizeof(int), 1, source) != 1 || count < 0
+            || sizeof(int) + (size_t)count * sizeof(Interval) > (size_t)size)
+        return false;
+    store_reserve(store, count);
+    size_t transferred = fread(store->items, sizeof(Interval), count, source);
+    if(transferred != (size_t)count)
+        return false;
+    for(int i = 0; i < count; i++)
+        store->items[i].flags = 0; // Was struct padding
+    store->count = count;
+    return true;
+}
+
+// INTERVALS_FILE as written before segments; true if it was the older
+// raw format.
+static bool pull_single_file(IntervalStore *store, char *file_name)
+{
+    char path[PATH_MAX];
+    get_data_path(path, file_name);
+
+    store->count = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st = {0}; // Size 0 rejects a legacy file if fstat fails
+    IntervalsHeader header;
+    if(fstat(fd, &st) != 0
+            || read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)
+            || memcmp(header.magic, INTERVALS_MAGIC, magic_length) != 0) {
+        FILE *source = fdopen(fd, "rb");
+        bool legacy = source && fseek(source, 0, SEEK_SET) == 0
+            && pull_legacy_intervals(store, source, st.st_size);
+        if(source)
+            fclose(source);
+        else
+            close(fd);
+        return legacy;
+    }
+
+    size_t data_size = (size_t)header.count * sizeof(DiskInterval);
+    if(header.version != intervals_version
+            || header.record_size != sizeof(DiskInterval)
+            || header.count > INT32_MAX
+            || (size_t)st.st_size != sizeof(header) + data_size
+            || header.count == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = (size_t)st.st_size;
+    void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    DiskInterval *records = (DiskInterval *)((char *)mapping + sizeof(header));
+    if(crc32c(0, records, data_size) != header.checksum) {
+        munmap(mapping, length);
+        return false;
+    }
+
+    int count = (int)header.count;
+    if(interval_layout_matches) {
+        store_free(store);
+        store->items = (Interval *)records;
+        store->count = store->capacity = count;
+        store->mapping = mapping;
+        store->mapping_length = length;
+        return false;
+    }
+
+    store_reserve(store, count);
+    for(int i = 0; i < count; i++)
+        decode_interval(&store->items[i], &records[i]);
+    store->count = count;
+    munmap(mapping, length);
+    return false;
+}
+
+// Drops the sessions of a sorted store that start before since
+static void store_trim_before(IntervalStore *store, time_t since)
+{
+    // A running session is always last, keep it however old it is
+    int low = store_lower_bound(store, since);
+    if(low == store->count && low > 0 && store->items[low - 1].end == 0)
+        low--;
+    memmove(store->items, &store->items[low], (size_t)(store->count - low) * sizeof(Interval));
+    store->count -= low;
+}
+
+// Only the sessions starting at or after since, found by bisection in
+// the mapped file. The checksum covers the whole file and is left to
+// pull_intervals(), so this stays cheap however long the history is.
+static void pull_recent_single_file(IntervalStore *store, char *file_name, time_t since)
+{
+    char path[PATH_MAX];
+    get_data_path(path, file_name);
+
+    store->count = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return;
+
+    struct stat st = {0}; // Size 0 rejects a legacy file if fstat fails
+    IntervalsHeader header;
+    if(fstat(fd, &st) != 0
+            || read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)
+            || memcmp(header.magic, INTERVALS_MAGIC, magic_length) != 0) {
+        // The raw format has no order to bisect, it is read whole
+        FILE *source = fdopen(fd, "rb");
+        if(source && fseek(source, 0, SEEK_SET) == 0
+                && pull_legacy_intervals(store, source, st.st_size)) {
+            store_sort(store);
+            store_trim_before(store, since);
+        }
+        else
+            store->count = 0;
+        if(source)
+            fclose(source);
+        else
+            close(fd);
+        return;
+    }
+    if(header.version != intervals_version
+            || header.record_size != sizeof(DiskInterval)
+            || header.count > INT32_MAX || header.count == 0
+            || (size_t)st.st_size != sizeof(header) + header.count * sizeof(DiskInterval)) {
+        close(fd);
+        return;
+    }
+
+    size_t length = (size_t)st.st_size;
+    void *mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return;
+
+    const DiskInterval *records = (const DiskInterval *)((char *)mapping + sizeof(header));
+    int low = 0, high = (int)header.count;
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(records[mid].start < since)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    // A running session is always last, keep it however old it is
+    if(low == (int)header.count && records[low - 1].end == 0)
+        low--;
+    for(int i = low; i < (int)header.count; i++)
+        decode_interval(store_append(store), &records[i]);
+    munmap(mapping, length);
+}
+
+// Returns true when the history still came from INTERVALS_FILE, or the
+// manifest was lost, and should be rewritten as segments. A damaged
+// month is read from its backup, or left out rather than costing the
+// whole history.
+bool pull_intervals(IntervalStore *store)
+{
+    SegmentEntry *entries;
+    int entry_count;
+    bool recovered = false;
+    if(!read_manifest(&entries, &entry_count)) {
+        recovered = scan_segments(&entries, &entry_count);
+        if(!recovered)
+            return pull_single_file(store, INTERVALS_FILE) || store->count > 0;
+    }
+
+    store->count = 0;
+    size_t total = 0;
+    for(int i = 0; i < entry_count; i++)
+        total += entries[i].count;
+    if(total <= INT32_MAX)
+        store_reserve(store, (int)total);
+    for(int i = 0; i < entry_count; i++)
+        pull_segment(store, entries[i].month);
+    free(entries);
+    return recovered; // Saving again writes a new manifest
+}
+
+// Opens only the months from since onwards, plus the last one in case
+// it holds a running session
+void pull_recent_intervals(IntervalStore *store, time_t since)
+{
+    SegmentEntry *entries;
+    int entry_count;
+    if(!read_manifest(&entries, &entry_count) && !scan_segments(&entries, &entry_count)) {
+        pull_recent_single_file(store, INTERVALS_FILE, since);
+        return;
+    }
+
+    store->count = 0;
+    int month = segment_month(since);
+    int first = entry_count;
+    while(first > 0 && entries[first - 1].month >= month)
+        first--;
+    if(first == entry_count && first > 0)
+        first--;
+    for(int i = first; i < entry_count; i++)
+        pull_segment(store, entries[i].month);
+    free(entries);
+    store_trim_before(store, since);
+}
+
+void journal_append(JournalOp op, const Interval *interval)
+{
+    char path[PATH_MAX];
+    get_data_path(path, JOURNAL_FILE);
+
+    FILE *dest = fopen(path, "ab");
+    if(!dest) {
+        fatal("CRITICAL: Cannot open journal");
+    }
+
+    JournalRecord record = {
+        .op = op,
+        .category_idx = interval->category_idx,
+        .start = interval->start,
+        .end = interval->end
+    };
+    if(fwrite(&record, sizeof(JournalRecord), 1, dest) != 1 || fflush(dest) != 0) {
+        fatal("CRITICAL: Failed to write journal");
+    }
+    fsync(fileno(dest)); // The record must survive a crash right after
+
+    fclose(dest);
+}
+
+static int find_interval(IntervalStore *store, time_t start)
+{
+    int idx = store_lower_bound(store, start);
+    if(idx < store->count && store->items[idx].start == start)
+        return idx;
+    return -1;
+}
+
+// Replay is idempotent: a crash between compaction and journal truncation
+// only replays records that are already reflected in the base file.
+void replay_journal(IntervalStore *store)
+{
+    char path[PATH_MAX];
+    get_data_path(path, JOURNAL_FILE);
+
+    FILE *source = fopen(path, "rb");
+    if(!source)
+        return;
+
+    JournalRecord record;
+    while(fread(&record, sizeof(JournalRecord), 1, source) == 1) {
+        int idx = find_interval(store, record.start);
+        Interval *interval;
+        switch(record.op) {
+        case journal_start:
+        case journal_end:
+            if(idx < 0)
+                interval = store_insert(store, record.start);
+            else
+                interval = &store->items[idx];
+            interval->category_idx = record.category_idx;
+            interval->end = record.op == journal_end ? record.end : 0;
+            break;
+        case journal_discard:
+            if(idx >= 0 && store->items[idx].end == 0)
+                delete_interval(store, idx);
+            break;
+        case journal_delete:
+            if(idx >= 0 && store->items[idx].end == record.end)
+                delete_interval(store, idx);
+            break;
+        case journal_restore:
+            if(idx >= 0 && store->items[idx].end == record.end)
+                restore_interval(store, idx);
+            break;
+        }
+    }
+
+    fclose(source);
+}
+
+// Fold the journal into the base file and start a fresh journal
+void compact_journal(IntervalStore *store)
+{
+    store_compact(store);
+    push_intervals(store);
+
+    char path[PATH_MAX];
+    get_data_path(path, JOURNAL_FILE);
+    FILE *journal = fopen(path, "wb");
+    if(journal)
+        fclose(journal);
+}
+
+long journal_size(void)
+{
+    char path[PATH_MAX];
+    get_data_path(path, JOURNAL_FILE);
+
+    FILE *source = fopen(path, "rb");
+    if(!source)
+        return 0;
+    fseek(source, 0, SEEK_END);
+    long records = ftell(source) / (long)sizeof(JournalRecord);
+    fclose(source);
+    return records;
+}
+
+// Sessions of deleted categories stay, under DELETED_CATEGORY
+void validate_intervals(IntervalStore *store)
+{
+    int valid_count = 0;
+    for(int i = 0; i < store->count; i++) {
+        Interval *iv = &store->items[i];
+        time_t duration = iv->end - iv->start;
+        if(is_deleted(iv))
+            continue;
+        if(iv->start == 0 && iv->end == 0)
+            continue;
+        // A running session, possibly started from the command line
+        bool open = iv->end == 0 && i == store->count - 1;
+        if(iv->end < iv->start && !open)
+            continue;
+        if(duration > hours_in_day * seconds_in_hour)
+            continue;
+        if(iv->category_idx >= 0 && iv->category_idx < max_category_ids) {
+            // Skip self-assignment so mapped pages are not copied
+            if(valid_count != i)
+                store->items[valid_count] = store->items[i];
+            valid_count++;
+        }
+    }
+    store->count = valid_count;
+    store->deleted = 0;
+}
+
+static void append_category(
+        Category *categories,
+        int *category_count,
+        char category_name[name_max_length],
+        int id)
+{
+    strncpy(categories[*category_count].name,
+            category_name, name_max_length - 1);
+    categories[*category_count].name[name_max_length - 1] = '\0';
+    categories[*category_count].id = id;
+    (*category_count)++;
+}
+
+static bool category_exists(
+        Category *categories,
+        int total,
+        char target[name_max_length],
+        int *idx
+        )
+{
+    for(int i = 0; i < total; i++) {
+        if(strcmp(categories[i].name, target) == 0) {
+            *idx = i;
+            return true;
+        }
+    }
+    *idx = total;
+    return false;
+}
+
+// A session as the import compares it
+typedef struct Fingerprint {
+    time_t start;
+    time_t end;
+    int category_idx;
+} Fingerprint;
+
+typedef struct FingerprintSlot {
+    uint32_t hash; // 0 marks an empty slot
+    uint32_t key;  // Index into keys, read only when the hash matches
+} FingerprintSlot;
+
+// Open-addressing set of sessions, kept at most half full so probes stay
+// short. Slots stay small for the probes; the full sessions sit in keys
+// so a hash collision never passes for a duplicate.
+typedef struct FingerprintSet {
+    FingerprintSlot *slots;
+    Fingerprint *keys;
+    size_t capacity; // Power of two
+    size_t count;
+} FingerprintSet;
+
+static uint32_t fingerprint_hash(const Fingerprint *key)
+{
+    // splitmix64 finalizer over the three fields
+    uint64_t hash = (uint64_t)key->start * 0x9E3779B97F4A7C15ull;
+    hash ^= (uint64_t)key->end + 0x632BE59BD9B4E019ull + (hash << 6) + (hash >> 2);
+    hash ^= (uint64_t)(uint32_t)key->category_idx * 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+    uint32_t folded = (uint32_t)(hash ^ hash >> 32);
+    return folded ? folded : 1;
+}
+
+static void fingerprint_reserve(FingerprintSet *set, size_t needed)
+{
+    if(needed * 2 <= set->capacity)
+        return;
+    size_t capacity = set->capacity > 0 ? set->capacity : initial_capacity;
+    while(needed * 2 > capacity)
+        capacity *= 2;
+    if(capacity / 2 > UINT32_MAX) {
+        fatal("CRITICAL: Cannot grow import fingerprints");
+    }
+
+    FingerprintSlot *slots = calloc(capacity, sizeof(FingerprintSlot));
+    Fingerprint *keys = realloc(set->keys, capacity / 2 * sizeof(Fingerprint));
+    if(!slots || !keys) {
+        fatal("CRITICAL: Cannot grow import fingerprints");
+    }
+    for(size_t i = 0; i < set->capacity; i++) {
+        if(!set->slots[i].hash)
+            continue;
+        size_t slot = set->slots[i].hash & (capacity - 1);
+        while(slots[slot].hash)
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = set->slots[i];
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->keys = keys;
+    set->capacity = capacity;
+}
+
+// Returns false if the session was already there
+static bool fingerprint_insert(FingerprintSet *set, time_t start, time_t end, int category_idx)
+{
+    fingerprint_reserve(set, set->count + 1);
+    Fingerprint key = { .start = start, .end = end, .category_idx = category_idx };
+    uint32_t hash = fingerprint_hash(&key);
+    size_t slot = hash & (set->capacity - 1);
+    while(set->slots[slot].hash) {
+        const Fingerprint *other = &set->keys[set->slots[slot].key];
+        if(set->slots[slot].hash == hash && other->start == start
+                && other->end == end && other->category_idx == category_idx)
+            return false;
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    set->keys[set->count] = key;
+    set->slots[slot] = (FingerprintSlot){ .hash = hash, .key = (uint32_t)set->count };
+    set->count++;
+    return true;
+}
+
+// Deleted sessions are left out, so importing one brings it back
+static void fingerprint_build(FingerprintSet *set, IntervalStore *store)
+{
+    fingerprint_reserve(set, store->count - store->deleted);
+    for(int i = 0; i < store->count; i++) {
+        Interval *interval = &store->items[i];
+        if(is_deleted(interval))
+            continue;
+        fingerprint_insert(set, interval->start, interval->end, interval->category_idx);
+    }
+}
+
+typedef struct CsvScanner {
+    const char *cur;
+    const char *end;
+} CsvScanner;
+
+// Copies the next field into dest, truncated to size, and returns its full
+// length. Quoted fields may hold commas, newlines and doubled quotes.
+static size_t csv_field(CsvScanner *sc, char *dest, size_t size, bool *row_end)
+{
+    size_t len = 0;
+    bool quoted = sc->cur < sc->end && *sc->cur == '"';
+    if(quoted)
+        sc->cur++;
+
+    while(sc->cur < sc->end) {
+        char c = *sc->cur;
+        if(quoted && c == '"') {
+            if(sc->cur + 1 < sc->end && sc->cur[1] == '"') {
+                sc->cur++;
+            } else {
+                quoted = false;
+                sc->cur++;
+                continue;
+            }
+        }
+        else if(!quoted && (c == ',' || c == '\n' || c == '\r'))
+            break;
+        if(len + 1 < size)
+            dest[len] = c;
+        len++;
+        sc->cur++;
+    }
+    dest[len < size ? len : size - 1] = '\0';
+
+    *row_end = true;
+    if(sc->cur < sc->end && *sc->cur == ',') {
+        *row_end = false;
+        sc->cur++;
+    } else {
+        if(sc->cur < sc->end && *sc->cur == '\r')
+            sc->cur++;
+        if(sc->cur < sc->end && *sc->cur == '\n')
+            sc->cur++;
+    }
+    return len;
+}
+
+static void csv_skip_row(CsvScanner *sc, bool row_end)
+{
+    char discard[1];
+    while(!row_end && sc->cur < sc->end)
+        csv_field(sc, discard, sizeof(discard), &row_end);
+}
+
+static bool scan_number(const char **p, int digits, int *value)
+{
+    *value = 0;
+    for(int i = 0; i < digits; i++, (*p)++) {
+        if(**p < '0' || **p > '9')
+            return false;
+        *value = *value * 10 + (**p - '0');
+    }
+    return true;
+}
+
+// YYYY-MM-DD[T ]hh:mm[:ss][.fraction][Z|+hh[:]mm|-hh[:]mm]. Without an
+// offset the time is taken as local.
+static bool parse_timestamp(const char *text, time_t *result)
+{
+    const char *p = text;
+    int year, month, day, hour, minute, second = 0;
+    if(!scan_number(&p, 4, &year) || *p++ != '-'
+            || !scan_number(&p, 2, &month) || *p++ != '-'
+            || !scan_number(&p, 2, &day) || (*p != 'T' && *p != ' '))
+        return false;
+    p++;
+    if(!scan_number(&p, 2, &hour) || *p++ != ':' || !scan_number(&p, 2, &minute))
+        return false;
+    if(*p == ':') {
+        p++;
+        if(!scan_number(&p, 2, &second))
+            return false;
+    }
+    if(*p == '.' || *p == ',') {
+        do p++; while(*p >= '0' && *p <= '9');
+    }
+    if(month < 1 || month > months_in_year || day < 1 || day > 31
+            || hour >= hours_in_day || minute >= minutes_in_hour || second > seconds_in_minute)
+        return false;
+
+    bool has_offset = false;
+    int offset = 0;
+    if(*p == 'Z') {
+        has_offset = true;
+        p++;
+    } else if(*p == '+' || *p == '-') {
+        int sign = *p++ == '-' ? -1 : 1;
+        int offset_h, offset_m;
+        if(!scan_number(&p, 2, &offset_h))
+            return false;
+        if(*p == ':')
+            p++;
+        if(!scan_number(&p, 2, &offset_m))
+            return false;
+        offset = sign * (offset_h * seconds_in_hour + offset_m * seconds_in_minute);
+        has_offset = true;
+    }
+    while(*p == ' ')
+        p++;
+    if(*p != '\0')
+        return false;
+
+    if(has_offset) {
+        *result = (time_t)((int64_t)days_from_civil(year, month, day) * seconds_in_day
+            + hour * seconds_in_hour + minute * seconds_in_minute + second - offset);
+        return true;
+    }
+    struct tm t = {
+        .tm_year = year - 1900, .tm_mon = month - 1, .tm_mday = day,
+        .tm_hour = hour, .tm_min = minute, .tm_sec = second, .tm_isdst = -1
+    };
+    *result = local_mktime(&t);
+    return true;
+}
+
+// Where an importer's fields are, found from the file's first line
+typedef struct ImportLayout {
+    int columns[import_columns]; // Field index, -1 if unused
+    int field_count;
+    const char *rows; // First data row
+} ImportLayout;
+
+typedef bool (*scan_import_row)(CsvScanner *sc, const ImportLayout *layout,
+        time_t *start, time_t *end, char tag[name_max_length]);
+
+typedef struct Importer {
+    const char *name;
+    const char *headers[import_columns]; // CSV header names, NULL if unused
+    bool (*detect)(const struct Importer *importer,
+            const char *data, const char *end, ImportLayout *layout);
+    scan_import_row scan_row;
+} Importer;
+
+static bool valid_duration(time_t start, time_t end)
+{
+    return end >= start && end - start <= hours_in_day * seconds_in_hour;
+}
+
+// Parses one data row, false if it has to be skipped
+static bool scan_csv_row(
+        CsvScanner *sc,
+        const ImportLayout *layout,
+        time_t *start, time_t *end,
+        char tag[name_max_length])
+{
+    char values[import_columns][field_max_length] = {{0}};
+    bool row_end = false;
+    bool valid = true;
+    for(int i = 0; i < layout->field_count; i++) {
+        if(row_end) {
+            valid = false;
+            break;
+        }
+        int column = -1;
+        for(int c = 0; c < import_columns; c++)
+            if(layout->columns[c] == i)
+                column = c;
+        if(column < 0) {
+            char discard[1];
+            csv_field(sc, discard, sizeof(discard), &row_end);
+            continue;
+        }
+        // Over-long timestamps are malformed, long tags are truncated
+        size_t len = column == column_category
+            ? csv_field(sc, tag, name_max_length, &row_end)
+            : csv_field(sc, values[column], field_max_length, &row_end);
+        if(len == 0 || (column != column_category && len >= field_max_length))
+            valid = false;
+    }
+    csv_skip_row(sc, row_end);
+    if(!valid)
+        return false;
+
+    char stamp[2 * field_max_length];
+    const char *start_text = values[column_start], *end_text = values[column_end];
+    if(layout->columns[column_start_time] >= 0) {
+        snprintf(stamp, sizeof(stamp), "%s %s", values[column_start], values[column_start_time]);
+        if(!parse_timestamp(stamp, start))
+            return false;
+        start_text = NULL;
+    }
+    if(layout->columns[column_end_time] >= 0) {
+        snprintf(stamp, sizeof(stamp), "%s %s", values[column_end], values[column_end_time]);
+        if(!parse_timestamp(stamp, end))
+            return false;
+        end_text = NULL;
+    }
+    if((start_text && !parse_timestamp(start_text, start))
+            || (end_text && !parse_timestamp(end_text, end)))
+        return false;
+    return valid_duration(*start, *end);
+}
+
+// Matches the header against the importer's names, in any order and case
+static bool detect_csv(const Importer *importer,
+        const char *data, const char *end,
+        ImportLayout *layout)
+{
+    CsvScanner sc = { data, end };
+    for(int c = 0; c < import_columns; c++)
+        layout->columns[c] = -1;
+    layout->field_count = 0;
+
+    bool row_end = false;
+    for(int i = 0; !row_end && sc.cur < sc.end; i++) {
+        char name[field_max_length];
+        csv_field(&sc, name, sizeof(name), &row_end);
+        for(int c = 0; c < import_columns; c++) {
+            if(importer->headers[c] && layout->columns[c] < 0
+                    && strcasecmp(name, importer->headers[c]) == 0) {
+                layout->columns[c] = i;
+                layout->field_count = i + 1;
+            }
+        }
+    }
+    layout->rows = sc.cur;
+
+    for(int c = 0; c < import_columns; c++)
+        if(importer->headers[c] && layout->columns[c] < 0)
+            return false;
+    return true;
+}
+
+// Basic ISO-8601 as Timewarrior writes it: 20250102T100000Z
+static bool parse_compact_timestamp(const char **p, const char *end, time_t *result)
+{
+    char text[] = "YYYY-MM-DDThh:mm:ssZ";
+    static const char shape[] = "YYYYMMDDThhmmssZ";
+    static const int at[] = { 0, 1, 2, 3, 5, 6, 8, 9, 10, 11, 12, 14, 15, 17, 18, 19 };
+    for(int i = 0; shape[i]; i++) {
+        if(*p + i >= end)
+            return false;
+        text[at[i]] = (*p)[i];
+    }
+    *p += sizeof(shape) - 1;
+    return parse_timestamp(text, result);
+}
+
+// inc 20250102T100000Z - 20250102T103000Z # tag "other tag"
+static bool scan_timewarrior_row(
+        CsvScanner *sc,
+        const ImportLayout *layout,
+        time_t *start, time_t *end,
+        char tag[name_max_length])
+{
+    (void)layout;
+    const char *line_end = memchr(sc->cur, '\n', sc->end - sc->cur);
+    if(!line_end)
+        line_end = sc->end;
+    const char *p = sc->cur;
+    sc->cur = line_end < sc->end ? line_end + 1 : line_end;
+
+    // Open intervals have no end yet
+    if(line_end - p < 4 || memcmp(p, "inc ", 4) != 0)
+        return false;
+    p += 4;
+    if(!parse_compact_timestamp(&p, line_end, start)
+            || line_end - p < 3 || memcmp(p, " - ", 3) != 0)
+        return false;
+    p += 3;
+    if(!parse_compact_timestamp(&p, line_end, end))
+        return false;
+
+    // The first tag names the category
+    while(p < line_end && (*p == ' ' || *p == '#'))
+        p++;
+    bool quoted = p < line_end && *p == '"';
+    if(quoted)
+        p++;
+    size_t len = 0;
+    while(p < line_end && *p != '\r' && (quoted ? *p != '"' : *p != ' ')) {
+        if(quoted && *p == '\\' && p + 1 < line_end)
+            p++;
+        if(len + 1 < name_max_length)
+            tag[len++] = *p;
+        p++;
+    }
+    tag[len] = '\0';
+    return len > 0 && valid_duration(*start, *end);
+}
+
+static bool detect_timewarrior(const Importer *importer,
+        const char *data, const char *end,
+        ImportLayout *layout)
+{
+    (void)importer;
+    layout->rows = data;
+    return end - data >= 4 && memcmp(data, "inc ", 4) == 0;
+}
+
+// Tried in order, the first whose header matches wins
+static const Importer importers[] = {
+    {
+        .name = "Toggl",
+        .headers = {
+            [column_start] = "Start date", [column_start_time] = "Start time",
+            [column_end] = "End date", [column_end_time] = "End time",
+            [column_category] = "Project"
+        },
+        .detect = detect_csv,
+        .scan_row = scan_csv_row
+    },
+    {
+        .name = "Forest",
+        .headers = {
+            [column_start] = "Start Time", [column_end] = "End Time",
+            [column_category] = "Tag"
+        },
+        .detect = detect_csv,
+        .scan_row = scan_csv_row
+    },
+    {
+        .name = "CSV",
+        .headers = {
+            [column_start] = "start", [column_end] = "end",
+            [column_category] = "category"
+        },
+        .detect = detect_csv,
+        .scan_row = scan_csv_row
+    },
+    {
+        .name = "Timewarrior",
+        .detect = detect_timewarrior,
+        .scan_row = scan_timewarrior_row
+    },
+};
+
+typedef struct ImportRow {
+    time_t start;
+    time_t end;
+    int tag; // Into the chunk's own tag table
+    int row; // Within the chunk, for the report
+} ImportRow;
+
+// A newline aligned slice of the export, parsed by one thread
+typedef struct ImportChunk {
+    const Importer *importer;
+    const ImportLayout *layout;
+    const char *begin;
+    const char *end;
+    ImportRow *rows;
+    int count;
+    int capacity;
+    int row_total;
+    int skipped;
+    int first_skipped_row;
+    // Tags in order of first appearance, mapped to categories afterwards
+    char (*tags)[name_max_length];
+    int *categories;
+    int tag_count;
+    int tag_capacity;
+    int last_tag;
+    bool failed;
+} ImportChunk;
+
+static int chunk_tag(ImportChunk *chunk, const char *tag)
+{
+    // Exports tend to repeat a tag over consecutive rows
+    if(chunk->last_tag < chunk->tag_count && strcmp(chunk->tags[chunk->last_tag], tag) == 0)
+        return chunk->last_tag;
+    for(int i = 0; i < chunk->tag_count; i++)
+        if(strcmp(chunk->tags[i], tag) == 0)
+            return chunk->last_tag = i;
+
+    if(chunk->tag_count == chunk->tag_capacity) {
+        int capacity = chunk->tag_capacity > 0 ? chunk->tag_capacity * 2 : max_categories;
+        char (*tags)[name_max_length] = realloc(chunk->tags, (size_t)capacity * name_max_length);
+        if(!tags)
+            return -1;
+        chunk->tags = tags;
+        chunk->tag_capacity = capacity;
+    }
+    strcpy(chunk->tags[chunk->tag_count], tag);
+    return chunk->last_tag = chunk->tag_count++;
+}
+
+static int compare_import_row(const void *a, const void *b)
+{
+    const ImportRow *row_a = (const ImportRow *)a;
+    const ImportRow *row_b = (const ImportRow *)b;
+    if(row_a->start != row_b->start)
+        return row_a->start < row_b->start ? -1 : 1;
+    return row_a->row - row_b->row;
+}
+
+static void *import_chunk(void *arg)
+{
+    ImportChunk *chunk = arg;
+    CsvScanner sc = { chunk->begin, chunk->end };
+    while(sc.cur < sc.end) {
+        if(*sc.cur == '\n' || *sc.cur == '\r') {
+            sc.cur++; // Blank line
+            continue;
+        }
+        int row = ++chunk->row_total;
+        time_t start, end;
+        char tag[name_max_length];
+        int tag_idx;
+        if(!chunk->importer->scan_row(&sc, chunk->layout, &start, &end, tag)) {
+            if(chunk->skipped++ == 0)
+                chunk->first_skipped_row = row;
+            continue;
+        }
+        if((tag_idx = chunk_tag(chunk, tag)) < 0) {
+            chunk->failed = true;
+            return NULL;
+        }
+
+        if(chunk->count == chunk->capacity) {
+            int capacity = chunk->capacity > 0 ? chunk->capacity * 2 : initial_capacity;
+            ImportRow *rows = realloc(chunk->rows, (size_t)capacity * sizeof(ImportRow));
+            if(!rows) {
+                chunk->failed = true;
+                return NULL;
+            }
+            chunk->rows = rows;
+            chunk->capacity = capacity;
+        }
+        chunk->rows[chunk->count++] = (ImportRow){ start, end, tag_idx, row };
+    }
+    qsort(chunk->rows, chunk->count, sizeof(ImportRow), compare_import_row);
+    return NULL;
+}
+
+// First row start at or after target. Quotes are counted from the last
+// boundary so a newline inside a quoted field is never taken for one.
+static const char *row_boundary(const char **scan, bool *quoted,
+        const char *target, const char *end)
+{
+    const char *p = *scan;
+    if(target < p)
+        target = p;
+    while((p = memchr(p, '"', target - p)) != NULL) {
+        *quoted = !*quoted;
+        p++;
+    }
+    for(p = target; p < end; p++) {
+        if(*p == '"')
+            *quoted = !*quoted;
+        else if(*p == '\n' && !*quoted) {
+            p++;
+            break;
+        }
+    }
+    *scan = p;
+    return p;
+}
+
+// Min-heap of runs keyed by their next start, for the k-way merge
+typedef struct MergeRun {
+    ImportRow *rows;
+    int count;
+    int next;
+} MergeRun;
+
+static time_t run_head(MergeRun *runs, int run)
+{
+    return runs[run].rows[runs[run].next].start;
+}
+
+static void heap_sift_down(int *heap, int size, MergeRun *runs, int i)
+{
+    while(1) {
+        int smallest = i;
+        int left = 2 * i + 1, right = left + 1;
+        // Ties go to the lower run, keeping file order
+        if(left < size && (run_head(runs, heap[left]) < run_head(runs, heap[smallest])
+                    || (run_head(runs, heap[left]) == run_head(runs, heap[smallest])
+                        && heap[left] < heap[smallest])))
+            smallest = left;
+        if(right < size && (run_head(runs, heap[right]) < run_head(runs, heap[smallest])
+                    || (run_head(runs, heap[right]) == run_head(runs, heap[smallest])
+                        && heap[right] < heap[smallest])))
+            smallest = right;
+        if(smallest == i)
+            return;
+        int swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+static int import_threads;
+
+// By default every thread gets at least import_chunk_min of the file, so
+// an export under 4 MiB (about 60k sessions of CSV) parses on one thread:
+// below that, starting workers and merging their runs costs more than
+// the parse they share. A fixed count overrides this, for benchmarks.
+void set_import_threads(int threads)
+{
+    import_threads = threads;
+}
+
+static int import_thread_count(size_t length)
+{
+    if(import_threads > 0)
+        return import_threads < import_max_threads ? import_threads : import_max_threads;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t by_size = length / import_chunk_min + 1;
+    int threads = cores > 0 ? (int)cores : 1;
+    if((size_t)threads > by_size)
+        threads = (int)by_size;
+    return threads < import_max_threads ? threads : import_max_threads;
+}
+
+// Splits the mapped export into newline aligned chunks parsed in parallel,
+// then interns tags and merges the sorted chunks into the store
+static void import_rows(
+        const Importer *importer,
+        const ImportLayout *layout,
+        const char *end,
+        IntervalStore *store,
+        Category *categories,
+        int *category_count,
+        FingerprintSet *seen,
+        ImportReport *report)
+{
+    const char *begin = layout->rows;
+
+    int threads = import_thread_count((size_t)(end - begin));
+    ImportChunk *chunks = calloc(threads, sizeof(ImportChunk));
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    bool *started = calloc(threads, sizeof(bool));
+    if(!chunks || !workers || !started) {
+        fatal("CRITICAL: Cannot allocate import workers");
+    }
+
+    const char *scan = begin;
+    bool quoted = false;
+    for(int t = 0; t < threads; t++) {
+        chunks[t].importer = importer;
+        chunks[t].layout = layout;
+        chunks[t].begin = t == 0 ? begin : chunks[t - 1].end;
+        chunks[t].end = t == threads - 1 ? end
+            : row_boundary(&scan, &quoted, begin + (end - begin) / threads * (t + 1), end);
+        if(chunks[t].end < chunks[t].begin)
+            chunks[t].end = chunks[t].begin;
+    }
+
+    // The zone table is loaded lazily, do it before the workers share it
+    local_zone();
+    for(int t = 1; t < threads; t++)
+        started[t] = pthread_create(&workers[t], NULL, import_chunk, &chunks[t]) == 0;
+    import_chunk(&chunks[0]);
+    for(int t = 1; t < threads; t++) {
+        if(started[t])
+            pthread_join(workers[t], NULL);
+        else
+            import_chunk(&chunks[t]);
+    }
+
+    // Tags get categories in order of first appearance across the file
+    int row_base[import_max_threads];
+    int rows_before = 0;
+    for(int t = 0; t < threads; t++) {
+        if(chunks[t].failed) {
+            fatal("CRITICAL: Cannot grow import buffers");
+        }
+        chunks[t].categories = malloc(((size_t)chunks[t].tag_count + 1) * sizeof(int));
+        if(!chunks[t].categories) {
+            fatal("CRITICAL: Cannot allocate import categories");
+        }
+        for(int i = 0; i < chunks[t].tag_count; i++) {
+            int ctgr_idx;
+            int id = -1;
+            if(category_exists(categories, *category_count, chunks[t].tags[i], &ctgr_idx))
+                id = categories[ctgr_idx].id;
+            else if(*category_count < max_categories) {
+                id = next_category_id(store, categories, *category_count);
+                if(id >= 0)
+                    append_category(categories, category_count, chunks[t].tags[i], id);
+            }
+            chunks[t].categories[i] = id;
+        }
+        if(chunks[t].skipped > 0 && report->skipped == 0)
+            report->first_skipped_row = rows_before + chunks[t].first_skipped_row;
+        report->skipped += chunks[t].skipped;
+        row_base[t] = rows_before;
+        rows_before += chunks[t].row_total;
+    }
+
+    // Existing sessions move to the tail and form one more run. Writes
+    // never overtake its read position, so the merge happens in place.
+    int imported = 0;
+    for(int t = 0; t < threads; t++)
+        imported += chunks[t].count;
+    int existing = store->count;
+    // A running session has to stay last, so rows starting once it is
+    // under way are skipped; they would overlap it anyway
+    Interval *running = open_session(store);
+    time_t open_start = running ? running->start : 0;
+    store_reserve(store, existing + imported);
+    memmove(&store->items[imported], store->items, (size_t)existing * sizeof(Interval));
+
+    MergeRun runs[import_max_threads];
+    int heap[import_max_threads];
+    int heap_size = 0;
+    for(int t = 0; t < threads; t++) {
+        runs[t] = (MergeRun){ chunks[t].rows, chunks[t].count, 0 };
+        if(runs[t].count > 0)
+            heap[heap_size++] = t;
+    }
+    for(int i = heap_size / 2 - 1; i >= 0; i--)
+        heap_sift_down(heap, heap_size, runs, i);
+
+    int out = 0, old = imported;
+    while(heap_size > 0) {
+        int t = heap[0];
+        ImportRow *row = &runs[t].rows[runs[t].next];
+        while(old < imported + existing && store->items[old].start <= row->start)
+            store->items[out++] = store->items[old++];
+
+        int id = chunks[t].categories[row->tag];
+        if(open_start && row->start >= open_start)
+            id = -1;
+        if(id >= 0 && !fingerprint_insert(seen, row->start, row->end, id)) {
+            report->duplicates++;
+        } else if(id >= 0) {
+            Interval *interval = &store->items[out++];
+            memset(interval, 0, sizeof(Interval));
+            interval->start = row->start;
+            interval->end = row->end;
+            interval->category_idx = id;
+            report->imported++;
+        } else {
+            int skipped_row = row_base[t] + row->row;
+            report->skipped++;
+            if(report->first_skipped_row == 0 || skipped_row < report->first_skipped_row)
+                report->first_skipped_row = skipped_row;
+        }
+
+        if(++runs[t].next == runs[t].count)
+            heap[0] = heap[--heap_size];
+        heap_sift_down(heap, heap_size, runs, 0);
+    }
+    while(old < imported + existing)
+        store->items[out++] = store->items[old++];
+    store->count = out;
+
+    for(int t = 0; t < threads; t++) {
+        free(chunks[t].rows);
+        free(chunks[t].tags);
+        free(chunks[t].categories);
+    }
+    free(chunks);
+    free(workers);
+    free(started);
+}
+
+// Maps a file, detects its format and merges its sessions into the store
+static ImportReport import_file(
+        const char *path,
+        IntervalStore *store,
+        Category *categories,
+        int *category_count,
+        FingerprintSet *seen)
+{
+    ImportReport report = {0};
+    const char *name = strrchr(path, '/');
+    snprintf(report.file, sizeof(report.file), "%s", name ? name + 1 : path);
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return report;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return report;
+    }
+    size_t length = (size_t)st.st_size;
+    const char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return report;
+    madvise((void *)data, length, MADV_SEQUENTIAL);
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // Spreadsheet exports often start with a UTF-8 byte order mark
+    const char *begin = data, *end = data + length;
+    if(length >= 3 && memcmp(begin, "\xEF\xBB\xBF", 3) == 0)
+        begin += 3;
+
+    ImportLayout layout;
+    for(size_t i = 0; i < sizeof(importers) / sizeof(importers[0]); i++) {
+        if(importers[i].detect(&importers[i], begin, end, &layout)) {
+            report.format = importers[i].name;
+            import_rows(&importers[i], &layout, end, store,
+                    categories, category_count, seen, &report);
+            break;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    report.seconds = (finished.tv_sec - started.tv_sec)
+        + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    munmap((void *)data, length);
+    return report;
+}
+
+// Imports the legacy Forest export once, then every file dropped into
+// IMPORT_DIR, which is renamed once its sessions are saved
+ImportReport *import_all(
+        IntervalStore *store,
+        Category *categories,
+        int *category_count,
+        int *report_count)
+{
+    ImportReport *reports = NULL;
+    *report_count = 0;
+    char path[PATH_MAX];
+    char dir_path[PATH_MAX];
+
+    char (*files)[PATH_MAX] = NULL;
+    int file_count = 0;
+    char marker[PATH_MAX];
+    get_data_path(marker, FOREST_IMPORTED);
+    if(!file_exists(marker)) {
+        get_data_path(path, FOREST_FILE);
+        if(file_exists(path)) {
+            files = malloc(sizeof(*files));
+            if(files)
+                strcpy(files[file_count++], path);
+        }
+        create_file(marker);
+    }
+
+    get_data_path(dir_path, IMPORT_DIR);
+    DIR *dir = opendir(dir_path);
+    struct dirent *entry;
+    size_t suffix_length = strlen(IMPORTED_SUFFIX);
+    while(dir && (entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if(entry->d_name[0] == '.' || (length >= suffix_length
+                    && strcmp(entry->d_name + length - suffix_length, IMPORTED_SUFFIX) == 0))
+            continue;
+        if(snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= (int)sizeof(path))
+            continue;
+        char (*grown)[PATH_MAX] = realloc(files, (file_count + 1) * sizeof(*files));
+        if(!grown)
+            break;
+        files = grown;
+        strcpy(files[file_count++], path);
+    }
+    if(dir)
+        closedir(dir);
+    if(file_count == 0) {
+        free(files);
+        return NULL;
+    }
+
+    reports = calloc(file_count, sizeof(ImportReport));
+    if(!reports) {
+        fatal("CRITICAL: Cannot allocate import reports");
+    }
+    // Sessions already stored or seen earlier in this run are skipped, so
+    // re-importing a file never counts it twice
+    FingerprintSet seen = {0};
+    fingerprint_build(&seen, store);
+    for(int i = 0; i < file_count; i++)
+        reports[i] = import_file(files[i], store, categories, category_count, &seen);
+    free(seen.slots);
+    free(seen.keys);
+
+    // Imported sessions are not journaled, persist them right away
+    push(categories, sizeof(Category), *category_count, CATEGORIES_FILE);
+    compact_journal(store);
+
+    for(int i = 0; i < file_count; i++) {
+        if(!reports[i].format || strncmp(files[i], dir_path, strlen(dir_path)) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s%s", files[i], IMPORTED_SUFFIX);
+        rename(files[i], path);
+    }
+    free(files);
+    *report_count = file_count;
+    return reports;
+}
+
+struct StoreLoader {
+    pthread_t thread;
+    bool threaded; // Loaded synchronously if no thread could be started
+    pthread_mutex_t lock;
+    bool done;
+    IntervalStore *store;
+    Category *categories;
+    int *category_count;
+    ImportReport *reports;
+    int report_count;
+};
+
+// Everything main() used to do before the first frame
+static void *load_store(void *arg)
+{
+    StoreLoader *loader = arg;
+    IntervalStore *store = loader->store;
+    bool legacy = pull_intervals(store);
+    store_sort(store);
+    replay_journal(store);
+    validate_intervals(store);
+    if(legacy)
+        compact_journal(store);
+    loader->reports = import_all(store, loader->categories,
+            loader->category_count, &loader->report_count);
+    rollup_map_categories(&store->rollup, loader->categories, *loader->category_count);
+    store_build_indexes(store);
+
+    pthread_mutex_lock(&loader->lock);
+    loader->done = true;
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+// Loads, validates, imports into and indexes store on a background
+// thread. Nothing may touch store, categories or the data files until
+// loader_finish() returned.
+StoreLoader *loader_start(IntervalStore *store, Category *categories, int *category_count)
+{
+    StoreLoader *loader = calloc(1, sizeof(StoreLoader));
+    if(!loader) {
+        fatal("CRITICAL: Cannot allocate history loader");
+    }
+    loader->store = store;
+    loader->categories = categories;
+    loader->category_count = category_count;
+    pthread_mutex_init(&loader->lock, NULL);
+    loader->threaded = pthread_create(&loader->thread, NULL, load_store, loader) == 0;
+    if(!loader->threaded)
+        load_store(loader);
+    return loader;
+}
+
+bool loader_done(StoreLoader *loader)
+{
+    pthread_mutex_lock(&loader->lock);
+    bool done = loader->done;
+    pthread_mutex_unlock(&loader->lock);
+    return done;
+}
+
+// Waits for the load and frees the loader, returning its import reports
+ImportReport *loader_finish(StoreLoader *loader, int *report_count)
+{
+    if(loader->threaded)
+        pthread_join(loader->thread, NULL);
+    pthread_mutex_destroy(&loader->lock);
+    ImportReport *reports = loader->reports;
+    *report_count = loader->report_count;
+    free(loader);
+    return reports;
+}
+
+void get_day_period(struct tm *dynamic_t, int *first_day, int *last_day)
+{
+    *first_day = *last_day = tm_day_number(dynamic_t);
+}
+
+void get_week_period(struct tm *dynamic_t, int *first_day, int *last_day)
+{
+    int days_since_monday = (dynamic_t->tm_wday + days_in_week - 1) % days_in_week;
+    *first_day = tm_day_number(dynamic_t) - days_since_monday;
+    *last_day = *first_day + days_in_week - 1;
+}
+
+void get_month_period(struct tm *dynamic_t, int *first_day, int *last_day)
+{
+    int year = dynamic_t->tm_year + 1900;
+    int month = dynamic_t->tm_mon + 1;
+    *first_day = days_from_civil(year, month, 1);
+    if(month == months_in_year)
+        *last_day = days_from_civil(year + 1, 1, 1) - 1;
+    else
+        *last_day = days_from_civil(year, month + 1, 1) - 1;
+}
+
+void get_year_period(struct tm *dynamic_t, int *first_day, int *last_day)
+{
+    int year = dynamic_t->tm_year + 1900;
+    *first_day = days_from_civil(year, 1, 1);
+    *last_day = days_from_civil(year + 1, 1, 1) - 1;
+}
+
+// Rows are formatted straight into one large buffer, nothing is
+// allocated per row
+struct ExportWriter {
+    int fd;
+    ExportFormat format;
+    bool failed;
+    bool first_record;
+    bool first_field;
+    size_t length;
+    char buffer[export_buffer_size];
+};
+
+const char *const export_extensions[export_formats] = { "csv", "json", "ndjson" };
+
+static void writer_flush(ExportWriter *w)
+{
+    size_t done = 0;
+    while(done < w->length && !w->failed) {
+        ssize_t written = write(w->fd, w->buffer + done, w->length - done);
+        if(written < 0 && errno != EINTR)
+            w->failed = true;
+        else if(written > 0)
+            done += (size_t)written;
+    }
+    w->length = 0;
+}
+
+static char *writer_reserve(ExportWriter *w, size_t size)
+{
+    if(w->length + size > export_buffer_size)
+        writer_flush(w);
+    return w->buffer + w->length;
+}
+
+static void writer_bytes(ExportWriter *w, const char *bytes, size_t size)
+{
+    // Bigger than the buffer, copy it in pieces
+    while(size > export_buffer_size) {
+        writer_bytes(w, bytes, export_buffer_size);
+        bytes += export_buffer_size;
+        size -= export_buffer_size;
+    }
+    memcpy(writer_reserve(w, size), bytes, size);
+    w->length += size;
+}
+
+static void writer_string(ExportWriter *w, const char *text)
+{
+    writer_bytes(w, text, strlen(text));
+}
+
+// Zero padded to at least width digits
+static void writer_number(ExportWriter *w, int64_t value, int width)
+{
+    char digits[24];
+    int len = 0;
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do {
+        digits[len++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude > 0 || len < width);
+
+    char *out = writer_reserve(w, len + 1);
+    int at = 0;
+    if(value < 0)
+        out[at++] = '-';
+    while(len > 0)
+        out[at++] = digits[--len];
+    w->length += at;
+}
+
+static char *put_digits(char *out, int value, int width)
+{
+    for(int i = width - 1; i >= 0; i--) {
+        out[i] = '0' + value % 10;
+        value /= 10;
+    }
+    return out + width;
+}
+
+static char *put_date(char *out, int year, int month, int day)
+{
+    out = put_digits(out, year, 4);
+    *out++ = '-';
+    out = put_digits(out, month, 2);
+    *out++ = '-';
+    return put_digits(out, day, 2);
+}
+
+static void writer_date(ExportWriter *w, int year, int month, int day)
+{
+    if(year < 0 || year > 9999) {
+        writer_number(w, year, 4);
+        writer_bytes(w, "-", 1);
+        writer_number(w, month, 2);
+        writer_bytes(w, "-", 1);
+        writer_number(w, day, 2);
+        return;
+    }
+    char *out = writer_reserve(w, date_input_length);
+    w->length += put_date(out, year, month, day) - out;
+}
+
+// Local time with its UTC offset, 2025-01-02T10:00:00+01:00
+static void writer_timestamp(ExportWriter *w, time_t timestamp)
+{
+    struct tm t;
+    local_civil(timestamp, &t);
+    int year = t.tm_year + 1900;
+    long offset = t.tm_gmtoff;
+    writer_date(w, year, t.tm_mon + 1, t.tm_mday);
+
+    char *start = writer_reserve(w, sizeof("Thh:mm:ss+hh:mm") - 1);
+    char *out = start;
+    *out++ = 'T';
+    out = put_digits(out, t.tm_hour, 2);
+    *out++ = ':';
+    out = put_digits(out, t.tm_min, 2);
+    *out++ = ':';
+    out = put_digits(out, t.tm_sec, 2);
+    *out++ = offset < 0 ? '-' : '+';
+    if(offset < 0)
+        offset = -offset;
+    out = put_digits(out, offset / seconds_in_hour, 2);
+    *out++ = ':';
+    out = put_digits(out, offset % seconds_in_hour / seconds_in_minute, 2);
+    w->length += out - start;
+}
+
+// Quoted for CSV only when it has to be, always escaped for JSON
+static void writer_text(ExportWriter *w, const char *text)
+{
+    if(w->format == export_csv) {
+        if(!strpbrk(text, ",\"\r\n")) {
+            writer_string(w, text);
+            return;
+        }
+        writer_bytes(w, "\"", 1);
+        for(const char *c = text; *c; c++) {
+            if(*c == '"')
+                writer_bytes(w, "\"\"", 2);
+            else
+                writer_bytes(w, c, 1);
+        }
+        writer_bytes(w, "\"", 1);
+        return;
+    }
+
+    writer_bytes(w, "\"", 1);
+    size_t plain = 0;
+    while(text[plain] && text[plain] != '"' && text[plain] != '\\'
+            && (unsigned char)text[plain] >= 0x20)
+        plain++;
+    writer_bytes(w, text, plain);
+    for(const unsigned char *c = (const unsigned char *)text + plain; *c; c++) {
+        if(*c == '"' || *c == '\\') {
+            char escaped[2] = { '\\', (char)*c };
+            writer_bytes(w, escaped, 2);
+        } else if(*c < 0x20) {
+            writer_string(w, "\\u00");
+            char hex[2] = { "0123456789abcdef"[*c >> 4], "0123456789abcdef"[*c & 15] };
+            writer_bytes(w, hex, 2);
+        } else
+            writer_bytes(w, (const char *)c, 1);
+    }
+    writer_bytes(w, "\"", 1);
+}
+
+static void export_begin(ExportWriter *w, const char *csv_header)
+{
+    w->first_record = true;
+    if(w->format == export_csv) {
+        writer_string(w, csv_header);
+        writer_bytes(w, "\n", 1);
+    } else if(w->format == export_json)
+        writer_bytes(w, "[", 1);
+}
+
+static void export_record(ExportWriter *w)
+{
+    w->first_field = true;
+    if(w->format == export_json)
+        writer_string(w, w->first_record ? "\n{" : ",\n{");
+    else if(w->format == export_ndjson)
+        writer_bytes(w, "{", 1);
+    w->first_record = false;
+}
+
+// Starts a field; JSON keys are written here, values by the writer_ calls
+static void export_field(ExportWriter *w, const char *name)
+{
+    if(!w->first_field)
+        writer_bytes(w, ",", 1);
+    w->first_field = false;
+    if(w->format != export_csv) {
+        writer_bytes(w, "\"", 1);
+        writer_string(w, name);
+        writer_bytes(w, "\":", 2);
+    }
+}
+
+// JSON strings are quoted, CSV values that cannot hold commas are not
+static void export_quote(ExportWriter *w)
+{
+    if(w->format != export_csv)
+        writer_bytes(w, "\"", 1);
+}
+
+static void export_record_end(ExportWriter *w)
+{
+    if(w->format == export_csv)
+        writer_bytes(w, "\n", 1);
+    else if(w->format == export_ndjson)
+        writer_bytes(w, "}\n", 2);
+    else
+        writer_bytes(w, "}", 1);
+}
+
+static void export_end(ExportWriter *w)
+{
+    if(w->format == export_json)
+        writer_string(w, w->first_record ? "]\n" : "\n]\n");
+    writer_flush(w);
+}
+
+// Every live session in start order, returns how many were written
+int export_sessions(ExportWriter *w,
+        IntervalStore *store,
+        Category *categories,
+        int category_count)
+{
+    int written = 0;
+    export_begin(w, "start,end,seconds,category");
+    for(int i = 0; i < store->count; i++) {
+        Interval *interval = &store->items[i];
+        if(is_deleted(interval) || interval->end == 0)
+            continue;
+        export_record(w);
+        export_field(w, "start");
+        export_quote(w);
+        writer_timestamp(w, interval->start);
+        export_quote(w);
+        export_field(w, "end");
+        export_quote(w);
+        writer_timestamp(w, interval->end);
+        export_quote(w);
+        export_field(w, "seconds");
+        writer_number(w, interval->end - interval->start, 1);
+        export_field(w, "category");
+        writer_text(w, category_label(categories, category_count, interval->category_idx));
+        export_record_end(w);
+        written++;
+    }
+    export_end(w);
+    return written;
+}
+
+// Seconds per local day and category from the rollup, skipping empty ones
+int export_days(ExportWriter *w,
+        DayRollup *rollup,
+        Category *categories,
+        int category_count)
+{
+    int written = 0;
+    export_begin(w, "date,category,seconds");
+    for(int i = 0; i < rollup->day_count; i++) {
+        int year, month, day;
+        civil_from_days(rollup->first_day + i, &year, &month, &day);
+        for(int c = 0; c <= category_count; c++) {
+            int slot = c < category_count ? c : deleted_category;
+            if(rollup->days[i][slot] == 0)
+                continue;
+            export_record(w);
+            export_field(w, "date");
+            export_quote(w);
+            writer_date(w, year, month, day);
+            export_quote(w);
+            export_field(w, "category");
+            writer_text(w, slot == deleted_category ? DELETED_CATEGORY : categories[slot].name);
+            export_field(w, "seconds");
+            writer_number(w, rollup->days[i][slot], 1);
+            export_record_end(w);
+            written++;
+        }
+    }
+    export_end(w);
+    return written;
+}
+
+ExportWriter *writer_open(int fd, ExportFormat format)
+{
+    ExportWriter *w = malloc(sizeof(ExportWriter));
+    if(!w) {
+        fatal("CRITICAL: Cannot allocate export buffer");
+    }
+    w->fd = fd;
+    w->format = format;
+    w->failed = false;
+    w->length = 0;
+    return w;
+}
+
+// Frees the writer, false if any write failed. The fd stays open.
+bool writer_close(ExportWriter *w)
+{
+    bool ok = !w->failed;
+    free(w);
+    return ok;
+}
+
+// Writes both exports into the home directory, false if either failed
+bool export_files(ExportFormat format,
+        IntervalStore *store,
+        Category *categories,
+        int category_count,
+        int *sessions, int *days)
+{
+    char name[field_max_length], path[PATH_MAX];
+    bool ok = true;
+    for(int kind = 0; kind < 2; kind++) {
+        snprintf(name, sizeof(name), "%s.%s",
+                kind == 0 ? EXPORT_SESSIONS : EXPORT_DAYS, export_extensions[format]);
+        get_data_path(path, name);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            ok = false;
+            continue;
+        }
+        ExportWriter *w = writer_open(fd, format);
+        if(kind == 0)
+            *sessions = export_sessions(w, store, categories, category_count);
+        else
+            *days = export_days(w, &store->rollup, categories, category_count);
+        if(!writer_close(w))
+            ok = false;
+        if(close(fd) != 0)
+            ok = false;
+    }
+    return ok;
+}
+
+// The session still running, if any; it is always the latest one
+Interval *open_session(IntervalStore *store)
+{
+    if(store->count == 0)
+        return NULL;
+    Interval *last = &store->items[store->count - 1];
+    return last->end == 0 && !is_deleted(last) ? last : NULL;
+}
+
@@ -0,0 +1,227 @@
+// Core of the time tracker: interval store, day rollups, local time,
+// persistence, import and export. Nothing in here touches the terminal,
+// so it can be linked into benchmarks and other front-ends.
+#ifndef TMTRACKER_H
+#define TMTRACKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+#define CATEGORIES_FILE ".categories.dat"
+#define INTERVALS_FILE ".intervals.dat" // Single file used before segments
+#define SEGMENTS_DIR ".intervals"
+#define JOURNAL_FILE ".intervals.journal"
+#define IMPORT_DIR ".tm_import" // Exports dropped here are imported on start
+#define EXPORT_SESSIONS "tm_sessions"
+#define EXPORT_DAYS "tm_days"
+#define DELETED_CATEGORY "[Deleted]" // Label of sessions whose category is gone
+
+enum {
+    name_max_length = 30,
+    max_categories = 5,
+    deleted_category = max_categories, // Slot sessions of deleted categories count under
+    category_slots = max_categories + 1,
+    max_category_ids = 256, // Ids handed out over time, deleted ones included
+    initial_capacity = 1024, // Interval slots allocated on first use
+    max_time = 120, // in minutes
+    hours_in_day = 24,
+    minutes_in_hour = 60,
+    seconds_in_minute = 60,
+    seconds_in_hour = 3600,
+    seconds_in_day = 86400,
+    days_in_year = 366,
+    days_in_week = 7,
+    months_in_year = 12,
+    min_time = 300, // in seconds
+    field_max_length = 64,
+    journal_compact_threshold = 256, // records before folding into base file
+    date_input_length = 10 // DD/MM/YYYY
+};
+
+typedef struct Category {
+    char name[name_max_length];
+    int id; // What sessions refer to it by, never changes
+} Category;
+
+typedef struct Interval {
+    int category_idx; // Category.id, not a position in the categories array
+    int flags;        // IntervalFlags, stored on disk
+    time_t start;
+    time_t end;
+} Interval;
+
+typedef enum IntervalFlags {
+    interval_deleted = 1 << 0 // Tombstone, skipped until the store is compacted
+} IntervalFlags;
+
+typedef int DayTotals[category_slots]; // Seconds per category slot
+
+// Focus totals bucketed by absolute local day (days since 1970-01-01).
+// tree holds a Fenwick tree per category over the same days, so any
+// [first_day, last_day] range sums in O(log n). Columns are slots in
+// the categories array; slots maps a session's category id to one.
+typedef struct DayRollup {
+    DayTotals *days;
+    DayTotals *tree;
+    int first_day;
+    int day_count;
+    unsigned char slots[max_category_ids]; // See rollup_map_categories()
+    bool mapped;
+} DayRollup;
+
+typedef enum ExportFormat {
+    export_csv,
+    export_json,
+    export_ndjson,
+    export_formats
+} ExportFormat;
+
+// Orders history can be viewed in; items themselves are always by date
+typedef enum SortOrder {
+    sort_date,
+    sort_duration,
+    sort_category,
+    sort_orders
+} SortOrder;
+
+// Growable interval array, capacity doubles whenever it runs out.
+// Right after loading, items may point into a private mapping of
+// INTERVALS_FILE; the first growth moves them to the heap.
+typedef struct IntervalStore {
+    Interval *items;
+    int count;
+    int capacity;
+    void *mapping;
+    size_t mapping_length;
+    DayRollup rollup; // Kept in sync once store_build_indexes() ran
+    int *orders[sort_orders]; // Live store positions per SortOrder
+    int orders_count;         // Positions currently held by each order
+    int orders_capacity;
+    int deleted;              // Tombstoned items still taking a slot
+    bool indexed;
+} IntervalStore;
+
+typedef enum JournalOp {
+    journal_start = 1, // Session opened, end is still 0
+    journal_end,       // Session closed and kept
+    journal_discard,   // Session given up before min_time
+    journal_delete,    // Finished session removed from history
+    journal_restore    // Deletion undone
+} JournalOp;
+
+typedef struct ImportReport {
+    const char *format; // NULL if the file was not recognized
+    char file[field_max_length];
+    int imported;
+    int skipped;
+    int first_skipped_row; // Data rows counted from 1, 0 if none
+    int duplicates; // Sessions already in the store
+    double seconds;
+} ImportReport;
+
+typedef void(*get_period)(struct tm*, int*, int*);
+
+// Full history load on a background thread, see loader_start()
+typedef struct StoreLoader StoreLoader;
+
+// Buffered writer behind every export format, see writer_open()
+typedef struct ExportWriter ExportWriter;
+
+extern const char *const export_extensions[export_formats];
+
+// Called before a fatal error is reported, e.g. to restore the terminal
+void set_fatal_handler(void (*handler)(void));
+
+// Dates, as days since 1970-01-01 in the local zone
+int days_from_civil(int year, int month, int day);
+void civil_from_days(int days, int *year, int *month, int *day);
+int tm_day_number(const struct tm *t);
+void local_civil(time_t timestamp, struct tm *t);
+time_t local_mktime(struct tm *t);
+time_t day_start(int day);
+
+// Period totals
+void rollup_map_categories(DayRollup *rollup, const Category *categories, int category_count);
+int category_slot(const DayRollup *rollup, int id);
+void rollup_add(DayRollup *rollup, const Interval *interval, int sign);
+int rollup_category_total(DayRollup *rollup,
+        int slot,
+        int first_day, int last_day);
+int get_period_total(DayRollup *rollup,
+        int category_count,
+        int first_day, int last_day);
+void get_day_period(struct tm *dynamic_t, int *first_day, int *last_day);
+void get_week_period(struct tm *dynamic_t, int *first_day, int *last_day);
+void get_month_period(struct tm *dynamic_t, int *first_day, int *last_day);
+void get_year_period(struct tm *dynamic_t, int *first_day, int *last_day);
+
+// Interval store
+Interval *store_append(IntervalStore *store);
+bool is_deleted(const Interval *interval);
+int store_lower_bound(IntervalStore *store, time_t start);
+void store_sort(IntervalStore *store);
+int store_count_between(IntervalStore *store, time_t from, time_t to);
+int store_ordered(IntervalStore *store, SortOrder sort, int rank);
+void store_build_orders(IntervalStore *store);
+void store_build_indexes(IntervalStore *store);
+void store_close_interval(IntervalStore *store, Interval *interval);
+int store_live_count(IntervalStore *store);
+void store_compact(IntervalStore *store);
+bool store_needs_compaction(IntervalStore *store);
+void store_free(IntervalStore *store);
+void delete_interval(IntervalStore *store, int idx);
+void restore_interval(IntervalStore *store, int idx);
+void validate_intervals(IntervalStore *store);
+Interval *open_session(IntervalStore *store);
+
+// Categories
+void delete_category(DayRollup *rollup, Category *categories, int *category_count, int idx);
+int next_category_id(const IntervalStore *store, const Category *categories, int category_count);
+const char *category_label(const Category *categories, int category_count, int id);
+
+// Persistence
+void push(void *attr, size_t size, int count, char *file_name);
+void pull(void *attr, size_t size, int *count, int capacity, char *file_name);
+void pull_categories(Category *categories, int *category_count);
+void push_intervals(IntervalStore *store);
+unsigned char *archive_encode(const Interval *items, int count, size_t *size);
+bool archive_decode(const unsigned char *data, size_t size, Interval *dest, int count);
+bool pull_intervals(IntervalStore *store);
+void pull_recent_intervals(IntervalStore *store, time_t since);
+StoreLoader *loader_start(IntervalStore *store, Category *categories, int *category_count);
+bool loader_done(StoreLoader *loader);
+ImportReport *loader_finish(StoreLoader *loader, int *report_count);
+void journal_append(JournalOp op, const Interval *interval);
+void replay_journal(IntervalStore *store);
+void compact_journal(IntervalStore *store);
+long journal_size(void);
+
+// Import and export
+ImportReport *import_all(
+        IntervalStore *store,
+        Category *categories,
+        int *category_count,
+        int *report_count);
+void set_import_threads(int threads); // 0 picks them by cores and file size
+ExportWriter *writer_open(int fd, ExportFormat format);
+bool writer_close(ExportWriter *w);
+int export_sessions(ExportWriter *w,
+        IntervalStore *store,
+        Category *categories,
+        int category_count);
+int export_days(ExportWriter *w,
+        DayRollup *rollup,
+        Category *categories,
+        int category_count);
+bool export_files(ExportFormat format,
+        IntervalStore *store,
+        Category *categories,
+        int category_count,
+        int *sessions, int *days);
+
+#endif